@@ -0,0 +1,628 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#define STBI_FAILURE_USERMSG
+#include "stb/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+#define IIR_GAUSS_BLUR_IMPLEMENTATION
+#include "iir_gauss_blur.h"
+#define THRESHOLD_GRADSNIP_IMPLEMENTATION
+#include "thresgradsnip.h"
+#define PNG_BANDS_IMPLEMENTATION
+#include "png_bands.h"
+
+// Benchmark of the stages of stbithresgrad on synthetic pages (text on a gradient background):
+// decode (PNG), blur, apply, blur with the fused value step and encode (PNG, png_bands) of the result.
+// Every stage runs `runs` times, the median is reported in MPix/s. The result of each page is
+// checked against a reference (a hash of the result and the global thresholds).
+
+#define BENCH_SIZES_MAX 32
+#define BENCH_RUNS_MAX 101
+#define BENCH_REFERENCE "bench/reference.txt"
+
+enum { BENCH_DECODE, BENCH_BLUR, BENCH_APPLY, BENCH_FUSED, BENCH_ENCODE, BENCH_STAGES };
+static const char* bench_stage_names[BENCH_STAGES] = {"decode", "blur", "apply", "blur+value", "encode"};
+
+void usage(char* progname)
+{
+    fprintf(stderr,
+        "%s %s %s\n",
+        "Usage:", progname, "[-h] [-w] [-p] [-s mpix] [-c components] [-n runs] [-t threads] [-g sigma] [-r reference]\n"
+        "Benchmark the stages of Grad (aka Gradient Snip) threshold on synthetic pages.\n"
+    );
+}
+
+void help(const char* sizes, const char* components, int runs, int threads, float sigma, const char* reference)
+{
+    fprintf(stderr,
+        "%s %s %s %s %s %d %s %d %s %f %s %s %s\n",
+        "  -s mpix        Page sizes in megapixels, separated by commas (default =", sizes, ").\n"
+        "  -c components  Components of the pages, separated by commas (default =", components, ").\n"
+        "  -n runs        Runs of every stage, the median is reported (default =", runs, ").\n"
+        "  -t threads     Threads of blur, value, apply and encode (default =", threads, ").\n"
+        "  -g sigma       Sigma of the blur (default =", sigma, ").\n"
+        "  -r reference   Reference results (default =", reference, ").\n"
+        "  -w             Write the results of all pages to the reference instead of checking them.\n"
+        "  -p             Only the round trip of the PNG encoder (every level and band layout).\n"
+        "  -h             display this help and exit.\n"
+        "\n"
+        "A page of 200 MPix with 4 components needs about 5 GB of memory."
+    );
+}
+
+static double bench_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static long bench_peak_rss_kb(void)
+{
+    struct rusage usage;
+    return (getrusage(RUSAGE_SELF, &usage) == 0) ? usage.ru_maxrss : 0;
+}
+
+static unsigned int bench_random(unsigned int* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 16) & 0x7fff;
+}
+
+// A document like page: a background that gets darker from the top left to the bottom right (uneven lighting),
+// lines of "glyphs" made of random strokes of a 5x7 grid, a few dark blocks (figures) and some noise.
+void bench_page(unsigned int width, unsigned int height, unsigned char components, unsigned int seed, unsigned char* image)
+{
+    size_t line = (size_t)width * components;
+    for (unsigned int y = 0; y < height; y++)
+    {
+        for (unsigned int x = 0; x < width; x++)
+        {
+            float light = 235.0f - 90.0f * ((float)x / width + (float)y / height) * 0.5f;
+            for (unsigned char c = 0; c < components; c++)
+            {
+                float v = light - ((c == 2) ? 12.0f : 0.0f) + (float)(bench_random(&seed) % 9) - 4.0f;
+                image[y * line + (size_t)x * components + c] = (c == 3) ? 255 : (unsigned char)v;
+            }
+        }
+    }
+
+    // Text: glyph cells of 5x7 strokes, the size of the glyphs grows with the page
+    unsigned int cell = (width / 160 > 4) ? width / 160 : 4;
+    unsigned int stroke = (cell / 5 > 1) ? cell / 5 : 1;
+    for (unsigned int y0 = 2 * cell; y0 + 2 * cell < height; y0 += 2 * cell)
+    {
+        if (bench_random(&seed) % 12 == 0)
+        {
+            continue;   // paragraph break
+        }
+        for (unsigned int x0 = 2 * cell; x0 + 2 * cell < width; x0 += cell)
+        {
+            if (bench_random(&seed) % 7 == 0)
+            {
+                continue;   // space
+            }
+            unsigned int glyph = bench_random(&seed) | (bench_random(&seed) << 15);
+            unsigned char ink = 20 + bench_random(&seed) % 60;
+            for (unsigned int g = 0; g < 35; g++)
+            {
+                if (!((glyph >> (g % 30)) & 1) || (g % 3 == 0))
+                {
+                    continue;
+                }
+                unsigned int gx = x0 + (g % 5) * cell / 6, gy = y0 + (g / 5) * cell * 3 / 14;
+                for (unsigned int y = gy; (y < gy + stroke + 1) && (y < height); y++)
+                {
+                    for (unsigned int x = gx; (x < gx + stroke + 1) && (x < width); x++)
+                    {
+                        for (unsigned char c = 0; (c < components) && (c < 3); c++)
+                        {
+                            image[y * line + (size_t)x * components + c] = ink;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Figures
+    for (int k = 0; k < 3; k++)
+    {
+        unsigned int fw = width / 5 + bench_random(&seed) % (width / 5 + 1), fh = height / 12 + bench_random(&seed) % (height / 12 + 1);
+        unsigned int fx = bench_random(&seed) % (width - fw + 1), fy = bench_random(&seed) % (height - fh + 1);
+        unsigned char shade = 60 + bench_random(&seed) % 100;
+        for (unsigned int y = fy; y < fy + fh; y++)
+        {
+            for (unsigned int x = fx; x < fx + fw; x++)
+            {
+                for (unsigned char c = 0; (c < components) && (c < 3); c++)
+                {
+                    image[y * line + (size_t)x * components + c] = (unsigned char)(shade + ((x - fx) * 80) / fw);
+                }
+            }
+        }
+    }
+}
+
+// FNV-1a over the result and the global thresholds
+unsigned long long bench_hash(const unsigned char* data, size_t size, unsigned long long hash)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+typedef struct
+{
+    unsigned char* data;
+    size_t size, capacity;
+} bench_memory;
+
+static int bench_append(void* context, const unsigned char* data, size_t size)
+{
+    bench_memory* m = (bench_memory*)context;
+    if (m->size + size > m->capacity)
+    {
+        size_t capacity = (m->capacity > 0) ? 2 * m->capacity : 65536;
+        while (capacity < m->size + size)
+        {
+            capacity *= 2;
+        }
+        unsigned char* grown = (unsigned char*)realloc(m->data, capacity);
+        if (grown == NULL)
+        {
+            return 0;
+        }
+        m->data = grown;
+        m->capacity = capacity;
+    }
+    memcpy(m->data + m->size, data, size);
+    m->size += size;
+    return 1;
+}
+
+static void bench_write(void* context, void* data, int size)
+{
+    bench_append(context, (const unsigned char*)data, (size_t)size);
+}
+
+static int bench_compare(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double bench_median(double* times, int runs)
+{
+    qsort(times, runs, sizeof(double), bench_compare);
+    return (runs % 2) ? times[runs / 2] : 0.5 * (times[runs / 2 - 1] + times[runs / 2]);
+}
+
+// Round trip of png_bands: the images of the layouts below are written at every level and checked
+typedef struct
+{
+    unsigned int width, height;
+    unsigned char components, depth;
+} bench_png_layout;
+
+static const bench_png_layout bench_png_layouts[] = {
+    {1, 1, 1, 8}, {1, 37, 1, 1}, {13, 29, 3, 8}, {13, 29, 1, 1}, {333, 211, 2, 8}, {333, 211, 4, 8},
+    {1021, 300, 1, 8},          // 2 bands of 256 rows
+    {701, 150, 3, 8},           // 2 bands of 124 rows
+    {4099, 600, 1, 1},          // 2 bands of 510 rows, 3 bits in the last byte of a row
+    {262143, 2, 1, 8},          // bands of one row, each longer than the window
+    {65537, 2, 4, 8},           // bands of one row
+    {2097145, 2, 1, 1}          // bands of one row, 1 bit in the last byte
+};
+
+// The samples of a layout: noise (stored blocks), flat areas with a few dots (matches across the bands) or a page
+// thresholded to 0 and 255, packed to 1 bit (1 = white) for a depth of 1
+static unsigned char* bench_png_image(const bench_png_layout* l, int kind, size_t* stride)
+{
+    size_t line = (size_t)l->width * l->components;
+    unsigned char* samples = (unsigned char*)malloc(line * l->height);
+    if (samples == NULL)
+    {
+        return NULL;
+    }
+    unsigned int seed = 7 + kind;
+    if (kind == 2)
+    {
+        bench_page(l->width, l->height, l->components, seed, samples);
+    }
+    for (size_t i = 0; i < line * l->height; i++)
+    {
+        unsigned int r = bench_random(&seed);
+        samples[i] = (kind == 0) ? (unsigned char)(r ^ (r >> 8)) : ((kind == 1) ? ((r % 997 == 0) ? 0 : 255) : ((samples[i] < 128) ? 0 : 255));
+    }
+    if (l->depth == 8)
+    {
+        *stride = line;
+        return samples;
+    }
+    *stride = ((size_t)l->width + 7) / 8;
+    unsigned char* bits = (unsigned char*)calloc(*stride * l->height, 1);
+    for (unsigned int y = 0; (bits != NULL) && (y < l->height); y++)
+    {
+        for (unsigned int x = 0; x < l->width; x++)
+        {
+            bits[y * *stride + x / 8] |= (samples[(size_t)y * l->width + x] >= 128) ? 0x80 >> (x % 8) : 0;
+        }
+    }
+    free(samples);
+    return bits;
+}
+
+// A file of png_bands: the CRC of every chunk, the Adler-32 of the zlib stream (inflated by stb_image) and the image
+// decoded by stb_image against the samples (a 1 bit image decodes to 0 and 255)
+static int bench_png_check(const bench_memory* png, const bench_png_layout* l, const unsigned char* image, size_t stride)
+{
+    const unsigned char* d = png->data;
+    size_t p = 8, size = 0;
+    int ok = (png->size >= 8) && (memcmp(d, "\x89PNG\r\n\x1a\n", 8) == 0), end = 0;
+    unsigned char* idat = (unsigned char*)malloc(png->size);
+    while (ok && idat != NULL && !end && (p + 12 <= png->size))
+    {
+        size_t length = ((size_t)d[p] << 24) | ((size_t)d[p + 1] << 16) | ((size_t)d[p + 2] << 8) | d[p + 3];
+        ok = (p + 12 + length <= png->size);
+        if (ok)
+        {
+            const unsigned char* c = d + p + 8 + length;
+            unsigned int crc = ((unsigned int)c[0] << 24) | ((unsigned int)c[1] << 16) | ((unsigned int)c[2] << 8) | c[3];
+            ok = (png_bands_crc32(0, d + p + 4, length + 4) == crc);
+            if (memcmp(d + p + 4, "IDAT", 4) == 0)
+            {
+                memcpy(idat + size, d + p + 8, length);
+                size += length;
+            }
+            end = (memcmp(d + p + 4, "IEND", 4) == 0);
+            p += 12 + length;
+        }
+    }
+    ok = ok && (idat != NULL) && end && (p == png->size) && (size > 6);
+    size_t line = (l->depth < 8) ? ((size_t)l->width + 7) / 8 : (size_t)l->width * l->components;
+    int filtered_size = 0;
+    char* filtered = ok ? stbi_zlib_decode_malloc((const char*)idat, (int)size, &filtered_size) : NULL;
+    if (ok)
+    {
+        const unsigned char* a = idat + size - 4;
+        unsigned int adler = ((unsigned int)a[0] << 24) | ((unsigned int)a[1] << 16) | ((unsigned int)a[2] << 8) | a[3];
+        ok = (filtered != NULL) && ((size_t)filtered_size == (line + 1) * l->height)
+            && (png_bands_adler32(1, (const unsigned char*)filtered, filtered_size) == adler);
+    }
+    free(filtered);
+    free(idat);
+    int w = 0, h = 0, c = 0;
+    unsigned char* decoded = ok ? stbi_load_from_memory(png->data, (int)png->size, &w, &h, &c, 0) : NULL;
+    ok = ok && (decoded != NULL) && ((unsigned int)w == l->width) && ((unsigned int)h == l->height) && (c == l->components);
+    for (unsigned int y = 0; ok && (y < l->height); y++)
+    {
+        const unsigned char* row = image + y * stride;
+        const unsigned char* out = decoded + (size_t)y * l->width * l->components;
+        if (l->depth == 8)
+        {
+            ok = (memcmp(row, out, line) == 0);
+        }
+        for (unsigned int x = 0; ok && (l->depth < 8) && (x < l->width); x++)
+        {
+            ok = (out[x] == (((row[x / 8] << (x % 8)) & 0x80) ? 255 : 0));
+        }
+    }
+    stbi_image_free(decoded);
+    return ok;
+}
+
+// Every layout, kind of samples and level: the file of png_bands_write on one thread checked by bench_png_check, the
+// same file on `threads` threads (at least 3, so a share has several bands) and from the stream in pieces of 1, 2,
+// 3, ... rows. Returns the number of failed files (they are reported).
+int bench_png_roundtrip(int threads, int* files)
+{
+    int failed = 0;
+    threads = (threads > 3) ? threads : 3;
+    for (size_t k = 0; k < sizeof(bench_png_layouts) / sizeof(bench_png_layouts[0]); k++)
+    for (int kind = 0; kind < 3; kind++)
+    {
+        const bench_png_layout* l = &bench_png_layouts[k];
+        size_t stride = 0;
+        unsigned char* image = bench_png_image(l, kind, &stride);
+        for (int level = 0; level <= 9; level++)
+        {
+            bench_memory one = {NULL, 0, 0}, more = {NULL, 0, 0}, stream = {NULL, 0, 0};
+            int ok = (image != NULL) && png_bands_write(bench_append, &one, l->width, l->height, l->components, l->depth, image, stride, level, 1)
+                && bench_png_check(&one, l, image, stride)
+                && png_bands_write(bench_append, &more, l->width, l->height, l->components, l->depth, image, stride, level, threads)
+                && (more.size == one.size) && (memcmp(more.data, one.data, one.size) == 0);
+            png_bands_stream* s = ok ? png_bands_begin(bench_append, &stream, l->width, l->height, l->components, l->depth, level, threads) : NULL;
+            for (unsigned int y = 0, n = 1; (s != NULL) && (y < l->height); y += n, n++)
+            {
+                n = (n < l->height - y) ? n : l->height - y;
+                ok = png_bands_rows(s, image + y * stride, stride, n) && ok;
+            }
+            ok = (s != NULL) && png_bands_end(s) && ok && (stream.size == one.size) && (memcmp(stream.data, one.data, one.size) == 0);
+            if (!ok)
+            {
+                fprintf(stderr, "ERROR: PNG round trip failed: %ux%u, %d components, %d bit, samples %d, level %d\n", l->width, l->height, l->components, l->depth, kind, level);
+                failed++;
+            }
+            (*files)++;
+            free(one.data);
+            free(more.data);
+            free(stream.data);
+        }
+        free(image);
+    }
+    return failed;
+}
+
+// Reference lines: width height components sigma hash
+int bench_reference_find(const char* reference, unsigned int width, unsigned int height, int components, float sigma, unsigned long long* hash)
+{
+    FILE* file = fopen(reference, "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+    unsigned int w, h;
+    int c, found = 0;
+    float s;
+    unsigned long long value;
+    char line[256];
+    while (!found && (fgets(line, sizeof(line), file) != NULL))
+    {
+        if ((sscanf(line, "%u %u %d %f %llx", &w, &h, &c, &s, &value) == 5) && (w == width) && (h == height) && (c == components) && (s == sigma))
+        {
+            *hash = value;
+            found = 1;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+int bench_values(const char* arg, float* values, int max)
+{
+    int n = 0;
+    const char* p = arg;
+    while ((*p != '\0') && (n < max))
+    {
+        char* end;
+        values[n] = strtof(p, &end);
+        if ((end == p) || !(values[n] > 0.0f))
+        {
+            return 0;
+        }
+        n++;
+        p = (*end == ',') ? end + 1 : end;
+        if ((*end != ',') && (*end != '\0'))
+        {
+            return 0;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char** argv)
+{
+    const char* sizes_arg = "1,4,16";
+    const char* components_arg = "1,3,4";
+    const char* reference = BENCH_REFERENCE;
+    int runs = 5;
+    float sigma = 10.0f, coef = 0.75f, delta = 0.0f;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = (cpus > 0) ? (int)cpus : 1;
+    int write_reference = 0;
+    int png_only = 0;
+
+    int opt;
+    while ( (opt = getopt(argc, argv, "s:c:n:t:g:r:wph")) != -1 )
+    {
+        switch(opt)
+        {
+            case 's':
+                sizes_arg = optarg;
+                break;
+            case 'c':
+                components_arg = optarg;
+                break;
+            case 'n':
+                runs = strtol(optarg, NULL, 10);
+                break;
+            case 't':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'g':
+                sigma = strtof(optarg, NULL);
+                break;
+            case 'r':
+                reference = optarg;
+                break;
+            case 'w':
+                write_reference = 1;
+                break;
+            case 'p':
+                png_only = 1;
+                break;
+            case 'h':
+                usage(argv[0]);
+                help(sizes_arg, components_arg, runs, threads, sigma, reference);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    float sizes[BENCH_SIZES_MAX], comps[BENCH_SIZES_MAX];
+    int nsizes = bench_values(sizes_arg, sizes, BENCH_SIZES_MAX);
+    int ncomps = bench_values(components_arg, comps, BENCH_SIZES_MAX);
+    if ((nsizes < 1) || (ncomps < 1) || (runs < 1) || (runs > BENCH_RUNS_MAX))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // the encoder first: every layout and level must decode to its image
+    int files = 0;
+    int failed = (bench_png_roundtrip(threads, &files) > 0);
+    printf("PNG round trip: %d files (levels 0 to 9, 8 and 1 bit), %s\n", files, failed ? "FAILED" : "ok");
+    if (png_only)
+    {
+        return failed;
+    }
+
+    FILE* out = NULL;
+    if (write_reference)
+    {
+        out = fopen(reference, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Failed to save %s.\n", reference);
+            return 4;
+        }
+        fprintf(out, "# width height components sigma hash (bench/bench.c, coeff 0.75, delta 0, bounds 0 255)\n");
+    }
+
+    printf("threads %d, sigma %g, runs %d (median)\n", threads, sigma, runs);
+    printf("%-10s %-11s %4s", "page", "size", "comp");
+    for (int k = 0; k < BENCH_STAGES; k++)
+    {
+        printf(" %11s", bench_stage_names[k]);
+    }
+    printf(" %10s  %s\n", "peak RSS", "reference");
+
+    for (int ks = 0; ks < nsizes; ks++)
+    for (int kc = 0; kc < ncomps; kc++)
+    {
+        // A4 proportions
+        unsigned int width = (unsigned int)(sqrt(sizes[ks] * 1e6 / 1.4142) + 0.5);
+        unsigned int height = (unsigned int)(width * 1.4142 + 0.5);
+        unsigned char components = (unsigned char)comps[kc];
+        size_t size = (size_t)width * height * components;
+        double mpix = (double)width * height / 1e6;
+
+        unsigned char* page = (unsigned char*)malloc(size);
+        unsigned char* image = (unsigned char*)malloc(size);
+        float* blur = (float*)malloc(size * sizeof(float));
+        if ((page == NULL) || (image == NULL) || (blur == NULL))
+        {
+            fprintf(stderr, "ERROR: not use memmory (%ux%u, %d components)\n", width, height, components);
+            free(page);
+            free(image);
+            free(blur);
+            failed = 1;
+            continue;
+        }
+        bench_page(width, height, components, 1 + ks * 31 + kc, page);
+
+        bench_memory png = {NULL, 0, 0};
+        stbi_write_png_to_func(bench_write, &png, width, height, components, page, 0);
+
+        // the contexts of the page: their buffers grow in the first run and are reused by the others
+        double times[BENCH_STAGES][BENCH_RUNS_MAX];
+        iir_gauss_blur_context blur_ctx;
+        iir_gauss_blur_context_init(&blur_ctx, sigma, threads, 0);
+        image_threshold_gradsnip_context ctx;
+        image_threshold_gradsnip_context_init(&ctx, sigma, threads, coef, delta, 0, 255, 0, 0, 0);
+        for (int r = 0; r < runs; r++)
+        {
+            double t = bench_now();
+            int w = 0, h = 0, c = 0;
+            unsigned char* decoded = stbi_load_from_memory(png.data, (int)png.size, &w, &h, &c, 0);
+            times[BENCH_DECODE][r] = bench_now() - t;
+            if ((decoded == NULL) || (memcmp(decoded, page, size) != 0))
+            {
+                fprintf(stderr, "ERROR: decode of the page failed\n");
+                failed = 1;
+            }
+            stbi_image_free(decoded);
+
+            t = bench_now();
+            iir_gauss_blur_context_run(&blur_ctx, width, height, components, 0, page, 0, 0, blur, NULL, NULL, NULL);
+            times[BENCH_BLUR][r] = bench_now() - t;
+
+            t = bench_now();
+            image_threshold_gradsnip_context_value(&ctx, width, height, components, page, 0, 0);
+            times[BENCH_FUSED][r] = bench_now() - t;
+
+            memcpy(image, page, size);
+            t = bench_now();
+            image_threshold_gradsnip_context_apply(&ctx, width, height, components, image, 0, 0, image, 0, NULL, 0);
+            times[BENCH_APPLY][r] = bench_now() - t;
+
+            bench_memory result = {NULL, 0, 0};
+            t = bench_now();
+            int encoded = png_bands_write(bench_append, &result, width, height, components, 8, image, (size_t)width * components, PNG_BANDS_LEVEL_DEFAULT, threads);
+            times[BENCH_ENCODE][r] = bench_now() - t;
+            if (r == 0)
+            {
+                // the encoded result decodes to the result
+                decoded = stbi_load_from_memory(result.data, (int)result.size, &w, &h, &c, 0);
+                if (!encoded || (decoded == NULL) || (memcmp(decoded, image, size) != 0))
+                {
+                    fprintf(stderr, "ERROR: encode of the result failed\n");
+                    failed = 1;
+                }
+                stbi_image_free(decoded);
+            }
+            free(result.data);
+        }
+        free(png.data);
+
+        unsigned long long hash = bench_hash(image, size, 14695981039346656037ull);
+        hash = bench_hash(ctx.threshold_global, components, hash);
+        const char* check = "written";
+        if (out != NULL)
+        {
+            fprintf(out, "%u %u %d %g %016llx\n", width, height, components, sigma, hash);
+        }
+        else
+        {
+            unsigned long long expected;
+            if (!bench_reference_find(reference, width, height, components, sigma, &expected))
+            {
+                check = "none";
+            }
+            else if (expected == hash)
+            {
+                check = "ok";
+            }
+            else
+            {
+                check = "FAILED";
+                failed = 1;
+            }
+        }
+
+        char name[32], dims[32];
+        snprintf(name, sizeof(name), "%.1f MPix", mpix);
+        snprintf(dims, sizeof(dims), "%ux%u", width, height);
+        printf("%-10s %-11s %4d", name, dims, components);
+        for (int k = 0; k < BENCH_STAGES; k++)
+        {
+            printf(" %11.1f", mpix / bench_median(times[k], runs));
+        }
+        printf(" %7ld MB  %s\n", bench_peak_rss_kb() / 1024, check);
+        fflush(stdout);
+
+        image_threshold_gradsnip_context_free(&ctx);
+        iir_gauss_blur_context_free(&blur_ctx);
+        free(page);
+        free(image);
+        free(blur);
+    }
+    printf("(MPix/s; peak RSS of the process so far)\n");
+
+    if ((out != NULL) && (fclose(out) != 0))
+    {
+        fprintf(stderr, "Failed to save %s.\n", reference);
+        return 4;
+    }
+    return failed;
+}
@@ -1,62 +1,1928 @@
 #define _GNU_SOURCE
 #include <stdio.h>
+#include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
 #include "stb/stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb/stb_image_write.h"
 #define IIR_GAUSS_BLUR_IMPLEMENTATION
 #include "iir_gauss_blur.h"
 #define THRESHOLD_GRADSNIP_IMPLEMENTATION
 #include "thresgradsnip.h"
+#define PNG_BANDS_IMPLEMENTATION
+#include "png_bands.h"
+#ifdef GRADSNIP_PNG_STB
+// PNG by stb_image_write instead of png_bands (one thread, its own deflate), for comparison or as a fallback
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+#endif
+
+void usage(char* progname)
+{
+    fprintf(stderr,
+        "%s %s %s\n",
+        "Usage:", progname, "[-h] [-i] [-s sigma] [-k coeff] [-d delta] [-l lower] [-u upper] [-t threads] [-r strip] [-b list] [-1] [-q] [-p] [-y] [-j stats] [-f format] [-z level] [-I] input-file output.png [input-file output.png ...]\n"
+        "Grad (aka Gradient Snip) threshold an image and save it as PNG (or PGM/PPM for .pgm, .ppm, .pnm, PBM for .pbm).\n"
+        "An input or output file - is the standard input or output.\n"
+     );
+}
+
+void help(float sigma, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int threads, int strip, int level)
+{
+    fprintf(stderr,
+        "%s %f %s %f %s %f %s %d %s %d %s %d %s %d %s %d %s\n",
+        "  -s sigma     The sigma of the gauss normal distribution (number >= 0.5, default =", sigma, ").\n"
+        "               Larger values result in a stronger blur.\n"
+        "  -k coeff     The coefficient local threshold (number, default =", coef, ").\n"
+        "  -d delta     The regulator threshold (number, default =", delta, ").\n"
+        "  -l lower     The bound lower threshold (integer, default =", bound_lower, ").\n"
+        "  -u upper     The bound upper threshold (integer, default =", bound_upper, ").\n"
+        "  -t threads   The number of threads of the blur and the PNG encoder (integer, default =", threads, ").\n"
+        "  -r strip     Process the image in strips of this many rows (0 = by sigma, default =", strip, ", whole image).\n"
+        "               Only binary PGM/PPM input is read strip by strip (other formats and stdin\n"
+        "               are read whole), the output is written row by row (PNG band by band).\n"
+        "  -b list      Batch: a file with an input and an output filename per line,\n"
+        "               the input-file output.png pairs of the command line follow it.\n"
+        "               Several pages (also given as input-file output.png pairs) are loaded,\n"
+        "               filtered and written at the same time in one process.\n"
+        "  -1           Save gray images as 1 bit PNG (.pbm output is always 1 bit, .pgm stays 8 bit).\n"
+        "  The values of -s, -k, -d, -l and -u can be lists (0.5,0.75,1) or ranges (0.5:1:0.25):\n"
+        "               every input is blurred once per sigma and thresholded with every setting,\n"
+        "               into output_s<sigma>_k<coeff>_d<delta>_l<lower>_u<upper>.png, with a table\n"
+        "               of the BW metrics on stdout.\n"
+        "  -q           Keep the blur in 16 bit fixed point instead of float (half the memory,\n"
+        "               -i shows the max deviation; not used with -r).\n"
+        "  -p           Pyramid blur: blur a downsampled image for large sigmas and upsample it\n"
+        "               (-i shows the factor and the deviation at an edge; not used with -r).\n"
+        "               Faster on large pages, but samples near their threshold flip: about 0.1 %,\n"
+        "               up to 1 % within 3 sigma of the borders (most of a small image).\n"
+        "  -y           Threshold the luma (Y) of color images into a gray (1 component) result,\n"
+        "               the luma is computed as the samples are read (no gray copy).\n"
+        "  -j stats     Write the time of every stage, the memory and the results as a JSON line\n"
+        "               per output image to the file stats (- = stdout).\n"
+        "  -f format    The format of every output: png, pnm (pgm, ppm) or pbm (default: by the\n"
+        "               extension of the output, png for - (stdout)); images with alpha can't be PGM/PPM.\n"
+        "  -z level     The compression level of PNG output, 0 (none) to 9 (smallest, slowest), default =", level, ".\n"
+        "               The rows are deflated in bands on the threads of -t.\n"
+        "  -I           Interactive: the page is blurred once, then commands on stdin (k, d, l, u\n"
+        "               value: a setting; v x y width height: the view, v: the page; z factor:\n"
+        "               a preview of every factor-th pixel, 1: full size; w [file]: write the\n"
+        "               view; q: quit) threshold only the 256x256 tiles of the view that changed.\n"
+        "  -i           info to stdout.\n"
+        "  -h           display this help and exit.\n"
+        "\n"
+        "You can use either sigma to specify the strengh of the blur.\n"
+        "\n"
+        "The performance is independent of the blur strengh (sigma). This tool is an\n"
+        "implementation of the paper \"Recursive implementaion of the Gaussian filter\"\n"
+        "by Ian T. Young and Lucas J. van Vliet.\n"
+        "\n"
+        "stb_image by Sean Barrett and others is used to read images.\n"
+    );
+}
+
+void info_params(const char* filename, int width, int height, int components, float sigma, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int threads)
+{
+    fprintf(stderr, "INFO: image %s\n", filename);
+    fprintf(stderr, "INFO: width %d\n", width);
+    fprintf(stderr, "INFO: height %d\n", height);
+    fprintf(stderr, "INFO: components %d\n", components);
+    fprintf(stderr, "INFO: sigma %f\n", sigma);
+    fprintf(stderr, "INFO: coeff. %f\n", coef);
+    fprintf(stderr, "INFO: delta %f\n", delta);
+    fprintf(stderr, "INFO: bound lower %d\n", bound_lower);
+    fprintf(stderr, "INFO: bound upper %d\n", bound_upper);
+    fprintf(stderr, "INFO: threads %d\n", threads);
+}
+
+void info_pyramid(float sigma)
+{
+    // away from the borders; within 3 sigma of them the blurs can differ by a few gray levels
+    fprintf(stderr, "INFO: blur pyramid 1/%u, deviation %f at an edge, more within %d pixels of the borders\n", iir_gauss_blur_pyramid_factor(sigma), iir_gauss_blur_pyramid_deviation(sigma), (int)ceilf(3.0f * sigma));
+}
+
+// Stats of a page (-j): the time of every stage, the buffers and the results, written as a JSON line
+typedef struct
+{
+    const char* input;
+    const char* output;
+    const char* mode;          // "whole", "strips" or "sweep"
+    int width, height, components;
+    float sigma, coef, delta;
+    unsigned char bound_lower, bound_upper;
+    int threads, fixed, luma;
+    unsigned int pyramid;      // downsampling factor of the pyramid blur (1: full size)
+    float gradient, bwm;
+    unsigned char threshold_global[256];
+    double decode, blur, apply, encode;    // seconds
+    size_t allocated;          // bytes of the buffers of the page (image, blur, result)
+    int error;
+} gradsnip_stats;
+
+double gradsnip_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Peak resident set size of the process so far, in bytes
+size_t gradsnip_peak_rss(void)
+{
+    struct rusage usage;
+    return (getrusage(RUSAGE_SELF, &usage) == 0) ? (size_t)usage.ru_maxrss * 1024 : 0;
+}
+
+void gradsnip_stats_init(gradsnip_stats* stats, const char* input, const char* output, const char* mode, float sigma, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int threads, int fixed, int luma)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->input = input;
+    stats->output = output;
+    stats->mode = mode;
+    stats->sigma = sigma;
+    stats->coef = coef;
+    stats->delta = delta;
+    stats->bound_lower = (bound_lower < bound_upper) ? bound_lower : bound_upper;
+    stats->bound_upper = (bound_lower < bound_upper) ? bound_upper : bound_lower;
+    stats->threads = threads;
+    stats->fixed = fixed;
+    stats->luma = luma;
+    stats->pyramid = 1;
+}
+
+static void gradsnip_json_string(FILE* file, const char* s)
+{
+    putc('"', file);
+    for (; *s != '\0'; s++)
+    {
+        unsigned char ch = (unsigned char)*s;
+        if ((ch == '"') || (ch == '\\'))
+        {
+            fprintf(file, "\\%c", ch);
+        }
+        else if (ch < 0x20)
+        {
+            fprintf(file, "\\u%04x", ch);
+        }
+        else
+        {
+            putc(ch, file);
+        }
+    }
+    putc('"', file);
+}
+
+// One line per page; the thresholds, the gradient and the BW metric only if the page was filtered
+void gradsnip_stats_write(FILE* file, const gradsnip_stats* stats)
+{
+    if (file == NULL)
+    {
+        return;
+    }
+    fprintf(file, "{\"input\":");
+    gradsnip_json_string(file, stats->input);
+    fprintf(file, ",\"output\":");
+    gradsnip_json_string(file, stats->output);
+    fprintf(file, ",\"mode\":\"%s\",\"blur_type\":\"%s\",\"luma\":%s,\"error\":%d", stats->mode, stats->fixed ? "fixed" : "float", stats->luma ? "true" : "false", stats->error);
+    fprintf(file, ",\"pyramid\":%u", stats->pyramid);
+    fprintf(file, ",\"width\":%d,\"height\":%d,\"components\":%d", stats->width, stats->height, stats->components);
+    fprintf(file, ",\"sigma\":%g,\"coeff\":%g,\"delta\":%g,\"lower\":%d,\"upper\":%d,\"threads\":%d",
+        stats->sigma, stats->coef, stats->delta, stats->bound_lower, stats->bound_upper, stats->threads);
+    if (stats->error == 0)
+    {
+        fprintf(file, ",\"gradient\":%f,\"thresholds\":[", stats->gradient);
+        for (int c = 0; c < (stats->luma ? 1 : stats->components); c++)
+        {
+            fprintf(file, (c > 0) ? ",%d" : "%d", stats->threshold_global[c]);
+        }
+        fprintf(file, "],\"bwm\":%f", stats->bwm);
+    }
+    fprintf(file, ",\"decode_ms\":%.3f,\"blur_ms\":%.3f,\"apply_ms\":%.3f,\"encode_ms\":%.3f,\"total_ms\":%.3f",
+        stats->decode * 1e3, stats->blur * 1e3, stats->apply * 1e3, stats->encode * 1e3,
+        (stats->decode + stats->blur + stats->apply + stats->encode) * 1e3);
+    fprintf(file, ",\"allocated_bytes\":%zu,\"peak_rss_bytes\":%zu}\n", stats->allocated, gradsnip_peak_rss());
+    fflush(file);
+}
+
+// Binary PGM (P5) / PPM (P6) with 8 bit samples: the rest of the header after its magic ('5' or '6'),
+// the file is left at the first sample
+int pnm_read_size(FILE* file, int magic, int* width, int* height, int* components)
+{
+    int values[3];
+    for (int k = 0; k < 3; k++)
+    {
+        int ch = getc(file);
+        while ((ch == '#') || (ch == ' ') || (ch == '\t') || (ch == '\r') || (ch == '\n'))
+        {
+            if (ch == '#')
+            {
+                while ((ch != '\n') && (ch != EOF))
+                {
+                    ch = getc(file);
+                }
+            }
+            ch = getc(file);
+        }
+        if ((ch < '0') || (ch > '9'))
+        {
+            return 0;
+        }
+        values[k] = 0;
+        while ((ch >= '0') && (ch <= '9'))
+        {
+            values[k] = values[k] * 10 + (ch - '0');
+            ch = getc(file);
+        }
+    }
+    // a single whitespace ends the header
+    if ((values[0] < 1) || (values[1] < 1) || (values[2] != 255))
+    {
+        return 0;
+    }
+    *width = values[0];
+    *height = values[1];
+    *components = (magic == '5') ? 1 : 3;
+    return 1;
+}
+
+// Binary PGM (P5) / PPM (P6) with 8 bit samples: read the header, the file is left at the first sample
+int pnm_read_header(FILE* file, int* width, int* height, int* components)
+{
+    int magic = (getc(file) == 'P') ? getc(file) : 0;
+    if ((magic != '5') && (magic != '6'))
+    {
+        return 0;
+    }
+    return pnm_read_size(file, magic, width, height, components);
+}
+
+// The standard input ("-") can't be read twice: the bytes read to look for a PGM/PPM header are handed to stb_image
+// first, then the rest of the stream (stb_image reads through callbacks)
+typedef struct
+{
+    FILE* file;
+    unsigned char head[2];
+    int size, pos;
+} image_stream;
+
+static int image_stream_read(void* user, char* data, int size)
+{
+    image_stream* s = (image_stream*)user;
+    int n = 0;
+    while ((n < size) && (s->pos < s->size))
+    {
+        data[n++] = (char)s->head[s->pos++];
+    }
+    return n + (int)fread(data + n, 1, size - n, s->file);
+}
+
+static void image_stream_skip(void* user, int n)
+{
+    // a pipe can't seek: read and drop
+    char buffer[4096];
+    while (n > 0)
+    {
+        int k = image_stream_read(user, buffer, (n < (int)sizeof(buffer)) ? n : (int)sizeof(buffer));
+        if (k <= 0)
+        {
+            break;
+        }
+        n -= k;
+    }
+}
+
+static int image_stream_eof(void* user)
+{
+    image_stream* s = (image_stream*)user;
+    return (s->pos >= s->size) && (feof(s->file) || ferror(s->file));
+}
+
+static const stbi_io_callbacks image_stream_callbacks = {image_stream_read, image_stream_skip, image_stream_eof};
+
+// Reads an image from a stream (the standard input): binary PGM/PPM into *buffer (it grows to fit, *capacity bytes),
+// anything else decoded by stb_image into *decoded. Several images can follow each other on the stream; stb_image reads
+// ahead, so an image of another format than PGM/PPM has to be the last one. Returns the image or NULL.
+unsigned char* image_read_stream(FILE* file, int* width, int* height, int* components, unsigned char** buffer, size_t* capacity, unsigned char** decoded)
+{
+    image_stream s = {file, {0, 0}, 0, 0};
+    s.size = (int)fread(s.head, 1, 2, file);
+    if ((s.size == 2) && (s.head[0] == 'P') && ((s.head[1] == '5') || (s.head[1] == '6')))
+    {
+        if (!pnm_read_size(file, s.head[1], width, height, components))
+        {
+            return NULL;
+        }
+        size_t size = (size_t)*width * *height * *components;
+        if (size > *capacity)
+        {
+            free(*buffer);
+            *buffer = (unsigned char*)malloc(size);
+            *capacity = (*buffer != NULL) ? size : 0;
+        }
+        return ((*buffer != NULL) && (fread(*buffer, 1, size, file) == size)) ? *buffer : NULL;
+    }
+    *decoded = stbi_load_from_callbacks(&image_stream_callbacks, &s, width, height, components, 0);
+    return *decoded;
+}
+
+int pnm_write_header(FILE* file, int width, int height, int components)
+{
+    return fprintf(file, "P%c\n%d %d\n255\n", (components == 1) ? '5' : '6', width, height) > 0;
+}
+
+// The format of every output (-f): ".png", ".pnm" or ".pbm", NULL: by the extension of the output
+static const char* image_format = NULL;
+
+// The compression level (-z) and the threads of the PNG encoder
+static int image_png_level = PNG_BANDS_LEVEL_DEFAULT;
+static int image_png_threads = 1;
+
+// The extension that picks the format of an output: the one of -f, PNG for the standard output ("-") or the extension
+const char* image_ext(const char* filename)
+{
+    if (image_format != NULL)
+    {
+        return image_format;
+    }
+    return (strcmp(filename, "-") == 0) ? ".png" : strrchr(filename, '.');
+}
+
+// An output file, or the standard output for "-"
+FILE* image_open(const char* filename)
+{
+    return (strcmp(filename, "-") == 0) ? stdout : fopen(filename, "wb");
+}
+
+// Closes an output file; the standard output is flushed (and stays open for the next page)
+int image_close(FILE* file)
+{
+    return (file == stdout) ? (fflush(file) == 0) : (fclose(file) == 0);
+}
+
+// Closes an output that failed half written and removes it, if it is a regular file (not the standard output, a pipe
+// or a device)
+void image_discard(FILE* file, const char* filename)
+{
+    struct stat st;
+    int regular = (file != stdout) && (fstat(fileno(file), &st) == 0) && S_ISREG(st.st_mode);
+    image_close(file);
+    if (regular)
+    {
+        remove(filename);
+    }
+}
+
+static int image_write_func(void* context, const unsigned char* data, size_t size)
+{
+    return fwrite(data, 1, size, (FILE*)context) == size;
+}
+
+#ifdef GRADSNIP_PNG_STB
+typedef struct
+{
+    FILE* file;
+    int ok;
+} image_writer;
+
+static void image_writer_func(void* context, void* data, int size)
+{
+    image_writer* writer = (image_writer*)context;
+    writer->ok = writer->ok && (fwrite(data, 1, size, writer->file) == (size_t)size);
+}
+
+// stb_image_write has no 1 bit PNG: the packed rows get their filter bytes (none) and are deflated by stbi_zlib_compress
+static int image_write_png_stb_bits(FILE* file, int width, int height, const unsigned char* image, size_t stride)
+{
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    // 1 bit gray, deflate, filter method 0, no interlace
+    unsigned char header[13] = {width >> 24, width >> 16, width >> 8, width, height >> 24, height >> 16, height >> 8, height, 1, 0, 0, 0, 0};
+    size_t line = (size_t)(width + 7) / 8 + 1;
+    unsigned char* rows = (unsigned char*)malloc(line * height);
+    int size = 0;
+    unsigned char* data = NULL;
+    if (rows != NULL)
+    {
+        for (int y = 0; y < height; y++)
+        {
+            rows[y * line] = 0;
+            memcpy(rows + y * line + 1, image + y * stride, line - 1);
+        }
+        data = stbi_zlib_compress(rows, (int)(line * height), &size, (image_png_level > 0) ? image_png_level : 1);
+        free(rows);
+    }
+    int ok = (data != NULL) && (fwrite(signature, 1, 8, file) == 8) && png_bands_chunk(image_write_func, file, "IHDR", header, 13, NULL)
+        && png_bands_chunk(image_write_func, file, "IDAT", data, size, NULL) && png_bands_chunk(image_write_func, file, "IEND", NULL, 0, NULL);
+    free(data);
+    return ok;
+}
+#endif
+
+// PNG of 8 bit samples (depth 8) or packed rows (depth 1, gray) to a file: the bands of rows are deflated on the threads
+// of -t (stb_image_write with GRADSNIP_PNG_STB)
+int image_write_png_file(FILE* file, int width, int height, int components, int depth, const unsigned char* image, size_t stride)
+{
+#ifdef GRADSNIP_PNG_STB
+    if (depth < 8)
+    {
+        return image_write_png_stb_bits(file, width, height, image, stride);
+    }
+    image_writer writer = {file, 1};
+    stbi_write_png_compression_level = (image_png_level > 0) ? image_png_level : 1;
+    return stbi_write_png_to_func(image_writer_func, &writer, width, height, components, image, (int)stride) && writer.ok;
+#else
+    return png_bands_write(image_write_func, file, width, height, components, depth, image, stride, image_png_level, image_png_threads);
+#endif
+}
+
+int image_write_png_rows(const char* filename, int width, int height, int components, int depth, const unsigned char* image, size_t stride)
+{
+    FILE* file = image_open(filename);
+    if (file == NULL)
+    {
+        return 0;
+    }
+    int ok = image_write_png_file(file, width, height, components, depth, image, stride);
+    return image_close(file) && ok;
+}
+
+// PNG written row by row (strips): the rows go into the bands of png_bands, which are written as they fill (with
+// GRADSNIP_PNG_STB the rows are collected and the whole image is written at the end)
+typedef struct
+{
+    FILE* file;
+    png_bands_stream* stream;
+    unsigned char* rows;
+    size_t line;
+    int width, height, components, depth, count;
+} image_png;
+
+image_png* image_png_begin(FILE* file, int width, int height, int components, int depth)
+{
+    image_png* png = (image_png*)calloc(1, sizeof(image_png));
+    if (png == NULL)
+    {
+        return NULL;
+    }
+    png->file = file;
+    png->line = (depth < 8) ? (size_t)(width + 7) / 8 : (size_t)width * components;
+    png->width = width;
+    png->height = height;
+    png->components = components;
+    png->depth = depth;
+#ifdef GRADSNIP_PNG_STB
+    png->rows = (unsigned char*)malloc(png->line * height);
+    if (png->rows == NULL)
+#else
+    png->stream = png_bands_begin(image_write_func, file, width, height, components, depth, image_png_level, image_png_threads);
+    if (png->stream == NULL)
+#endif
+    {
+        free(png);
+        return NULL;
+    }
+    return png;
+}
+
+int image_png_row(image_png* png, const unsigned char* row)
+{
+    if (png->count >= png->height)
+    {
+        return 0;
+    }
+    png->count++;
+    if (png->stream != NULL)
+    {
+        return png_bands_rows(png->stream, row, png->line, 1);
+    }
+    memcpy(png->rows + (png->count - 1) * png->line, row, png->line);
+    return 1;
+}
+
+// Writes the end of the file (or the whole file) and frees the writer; before the last row it only frees it (0)
+int image_png_end(image_png* png)
+{
+    int ok = (png->count == png->height);
+    if (png->stream != NULL)
+    {
+        ok = png_bands_end(png->stream) && ok;
+    }
+    else
+    {
+        ok = ok && image_write_png_file(png->file, png->width, png->height, png->components, png->depth, png->rows, png->line);
+    }
+    free(png->rows);
+    free(png);
+    return ok;
+}
+
+int image_write_png(const char* filename, int width, int height, int components, unsigned char* image)
+{
+    return image_write_png_rows(filename, width, height, components, 8, image, (size_t)width * components);
+}
+
+// The extensions .pgm, .ppm and .pnm
+int image_ext_pnm(const char* filename)
+{
+    const char* ext = image_ext(filename);
+    return (ext != NULL) && ((strcasecmp(ext, ".pgm") == 0) || (strcasecmp(ext, ".ppm") == 0) || (strcasecmp(ext, ".pnm") == 0));
+}
+
+// PGM/PPM for the extensions .pgm, .ppm and .pnm (1 or 3 components), PNG otherwise
+int image_write_pnm(const char* filename, int components)
+{
+    return image_ext_pnm(filename) && ((components == 1) || (components == 3));
+}
+
+// 1 bit output: gray images to .pbm, or to PNG when asked for (a .pgm/.pnm output stays 8 bit)
+int image_write_bits_mode(const char* filename, int components, int packed)
+{
+    const char* ext = image_ext(filename);
+    return (components == 1) && ((packed && !image_ext_pnm(filename)) || ((ext != NULL) && (strcasecmp(ext, ".pbm") == 0)));
+}
+
+// Whether the output can take a result of `components` components (bits_mode: packed): PBM only a gray one, PGM/PPM a
+// gray or RGB one (a result with alpha is not written as PNG under their name). The error is reported.
+int image_write_fits(const char* filename, int components, int bits_mode)
+{
+    const char* ext = image_ext(filename);
+    if (!bits_mode && (ext != NULL) && (strcasecmp(ext, ".pbm") == 0))
+    {
+        fprintf(stderr, "ERROR: PBM needs a gray image\n");
+        return 0;
+    }
+    if (image_ext_pnm(filename) && !image_write_pnm(filename, components))
+    {
+        fprintf(stderr, "ERROR: PGM/PPM needs a gray or RGB image, not %d components\n", components);
+        return 0;
+    }
+    return 1;
+}
+
+// Packed rows: a zero byte (room for a PNG filter type) and (width + 7) / 8 bytes of 1 bit samples, 1 = white
+size_t image_bits_stride(int width)
+{
+    return (size_t)(width + 7) / 8 + 1;
+}
+
+int pbm_write_header(FILE* file, int width, int height)
+{
+    return fprintf(file, "P4\n%d %d\n", width, height) > 0;
+}
+
+// One packed row to PBM, where 1 is black
+int pbm_write_row(FILE* file, int width, const unsigned char* row)
+{
+    unsigned char line[4096];
+    size_t size = image_bits_stride(width) - 1;
+    row++;
+    while (size > 0)
+    {
+        size_t n = (size < sizeof(line)) ? size : sizeof(line);
+        for (size_t i = 0; i < n; i++)
+        {
+            line[i] = ~row[i];
+        }
+        if (fwrite(line, 1, n, file) != n)
+        {
+            return 0;
+        }
+        row += n;
+        size -= n;
+    }
+    return 1;
+}
+
+int image_write_bits(const char* filename, int width, int height, unsigned char* bits)
+{
+    const char* ext = image_ext(filename);
+    if ((ext == NULL) || (strcasecmp(ext, ".pbm") != 0))
+    {
+        return image_write_png_rows(filename, width, height, 1, 1, bits + 1, image_bits_stride(width));
+    }
+    FILE* file = image_open(filename);
+    if (file == NULL)
+    {
+        return 0;
+    }
+    size_t stride = image_bits_stride(width);
+    int ok = pbm_write_header(file, width, height);
+    for (int y = 0; (y < height) && ok; y++)
+    {
+        ok = pbm_write_row(file, width, bits + y * stride);
+    }
+    return image_close(file) && ok;
+}
+
+int image_write(const char* filename, int width, int height, int components, unsigned char* image)
+{
+    if (!image_write_fits(filename, components, 0))
+    {
+        return 0;
+    }
+    if (image_write_pnm(filename, components))
+    {
+        FILE* file = image_open(filename);
+        if (file == NULL)
+        {
+            return 0;
+        }
+        size_t size = (size_t)width * height * components;
+        int ok = pnm_write_header(file, width, height, components) && (fwrite(image, 1, size, file) == size);
+        return image_close(file) && ok;
+    }
+    return image_write_png(filename, width, height, components, image);
+}
+
+// Mapped PGM/PPM/PBM files: the samples start at offset
+typedef struct
+{
+    unsigned char* data;
+    size_t size, offset;
+    int fd;                    // output only
+    dev_t dev;                 // input only: the file, an output must not replace it while it is mapped
+    ino_t ino;
+} image_map;
+
+// Maps the file from its start up to the end of the samples (the file is at the first sample after pnm_read_header),
+// NULL if it can't be mapped (not a regular file, too short)
+unsigned char* image_map_read(FILE* file, size_t size, image_map* map)
+{
+    struct stat st;
+    long offset = ftell(file);
+    if ((offset < 0) || (fstat(fileno(file), &st) != 0) || !S_ISREG(st.st_mode) || ((size_t)st.st_size < (size_t)offset + size))
+    {
+        return NULL;
+    }
+    void* data = mmap(NULL, (size_t)offset + size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+    madvise(data, (size_t)offset + size, MADV_WILLNEED);
+    map->data = (unsigned char*)data;
+    map->size = (size_t)offset + size;
+    map->offset = (size_t)offset;
+    map->fd = -1;
+    map->dev = st.st_dev;
+    map->ino = st.st_ino;
+    return map->data + map->offset;
+}
+
+// Creates the file with the header and room for the samples (allocated on the disk, so a full disk fails here and not
+// while the samples are written) and maps it. NULL if it can't be mapped (not a regular file, the mapped input itself):
+// the file is written the usual way then.
+unsigned char* image_map_write(const char* filename, const char* header, size_t size, const image_map* input, image_map* map)
+{
+    struct stat st;
+    if ((stat(filename, &st) == 0) && (!S_ISREG(st.st_mode) || ((input != NULL) && (input->data != NULL) && (st.st_dev == input->dev) && (st.st_ino == input->ino))))
+    {
+        return NULL;
+    }
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    size_t offset = strlen(header);
+    void* data = (posix_fallocate(fd, 0, offset + size) == 0) ? mmap(NULL, offset + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (data == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+    memcpy(data, header, offset);
+    map->data = (unsigned char*)data;
+    map->size = offset + size;
+    map->offset = offset;
+    map->fd = fd;
+    return map->data + map->offset;
+}
+
+// Unmaps the file, the samples of a PBM are inverted first (packed rows have 1 = white, PBM has 1 = black)
+int image_map_close(image_map* map, int pbm)
+{
+    if (pbm)
+    {
+        for (size_t i = map->offset; i < map->size; i++)
+        {
+            map->data[i] = ~map->data[i];
+        }
+    }
+    int ok = (munmap(map->data, map->size) == 0);
+    if (map->fd >= 0)
+    {
+        ok = (close(map->fd) == 0) && ok;
+    }
+    map->data = NULL;
+    return ok;
+}
+
+// The result straight in its mapped output file: the samples of a PGM/PPM (8 bit) or the packed rows of a PBM
+// ((width + 7) / 8 bytes each, bits_mode), NULL for other outputs (the standard output) or if the file can't be mapped
+unsigned char* image_map_result(const char* filename, int width, int height, int components, int bits_mode, const image_map* input, image_map* map)
+{
+    const char* ext = image_ext(filename);
+    char header[64];
+    size_t size;
+    if (strcmp(filename, "-") == 0)
+    {
+        return NULL;
+    }
+    if (bits_mode && (ext != NULL) && (strcasecmp(ext, ".pbm") == 0))
+    {
+        snprintf(header, sizeof(header), "P4\n%d %d\n", width, height);
+        size = (size_t)(width + 7) / 8 * height;
+    }
+    else if (!bits_mode && image_write_pnm(filename, components))
+    {
+        snprintf(header, sizeof(header), "P%c\n%d %d\n255\n", (components == 1) ? '5' : '6', width, height);
+        size = (size_t)width * height * components;
+    }
+    else
+    {
+        return NULL;
+    }
+    return image_map_write(filename, header, size, input, map);
+}
+
+// Strip mode: the rows come from a binary PGM/PPM file (or the decoded image) and go to a PGM/PPM/PBM file or to the
+// bands of a PNG stream; with luma (-y) the rows of luma components per pixel are turned into their luma as they are read
+typedef struct
+{
+    FILE* input;
+    long offset;
+    unsigned char* image;
+    unsigned char luma;
+    unsigned char* samples;    // the rows as read from the file, before their luma
+    size_t samples_size;
+    FILE* output;
+    image_png* png;            // PNG output, NULL: PGM/PPM/PBM rows
+    unsigned char* bits;       // one packed row
+    unsigned int width;
+    unsigned char components;
+    float coef, delta;
+    unsigned char bound_lower, bound_upper;
+    unsigned char* threshold_global;
+    double* sums;
+    size_t count_black;
+    int failed;
+} gradsnip_strip;
+
+static int gradsnip_strip_read(void* user, unsigned int y, unsigned int count, unsigned char* rows)
+{
+    gradsnip_strip* s = (gradsnip_strip*)user;
+    size_t line = (size_t)s->width * (s->luma ? s->luma : s->components);
+    const unsigned char* samples = (s->input == NULL) ? s->image + y * line : rows;
+    if (s->input != NULL)
+    {
+        if ((y == 0) && (fseek(s->input, s->offset, SEEK_SET) != 0))
+        {
+            return 0;
+        }
+        if (s->luma && (count * line > s->samples_size))
+        {
+            free(s->samples);
+            s->samples = (unsigned char*)malloc(count * line);
+            s->samples_size = (s->samples != NULL) ? count * line : 0;
+            if (s->samples == NULL)
+            {
+                return 0;
+            }
+        }
+        samples = s->luma ? s->samples : rows;
+        if (fread((unsigned char*)samples, line, count, s->input) != count)
+        {
+            return 0;
+        }
+    }
+    if (s->luma)
+    {
+        for (size_t i = 0; i < (size_t)count * s->width; i++)
+        {
+            rows[i] = iir_gauss_blur_luma(samples + i * s->luma, s->luma);
+        }
+    }
+    else if (s->input == NULL)
+    {
+        memcpy(rows, samples, count * line);
+    }
+    return 1;
+}
+
+static void gradsnip_strip_value(void* user, unsigned int y, unsigned char* image, const float* row)
+{
+    gradsnip_strip* s = (gradsnip_strip*)user;
+    image_threshold_gradsnip_value_row(s->width, s->components, image, row, s->sums);
+}
+
+static void gradsnip_strip_apply(void* user, unsigned int y, unsigned char* image, const float* row)
+{
+    gradsnip_strip* s = (gradsnip_strip*)user;
+    size_t line = (size_t)s->width * s->components;
+    if (s->bits != NULL)
+    {
+        s->bits[0] = 0;
+        s->count_black += image_threshold_gradsnip_apply_row_bits(s->width, s->components, s->coef, s->delta, s->bound_lower, s->bound_upper, image, row, s->threshold_global, s->bits + 1);
+        if (!((s->png != NULL) ? image_png_row(s->png, s->bits + 1) : pbm_write_row(s->output, s->width, s->bits)))
+        {
+            s->failed = 1;
+        }
+        return;
+    }
+    s->count_black += image_threshold_gradsnip_apply_row(s->width, s->components, s->coef, s->delta, s->bound_lower, s->bound_upper, image, row, s->threshold_global);
+    if (!((s->png != NULL) ? image_png_row(s->png, image) : (fwrite(image, 1, line, s->output) == line)))
+    {
+        s->failed = 1;
+    }
+}
+
+// Both runs over the strips of a loaded input (s->input or s->image); the output is opened into s->output and s->png,
+// the caller closes what is left open
+static int gradsnip_strips_run(gradsnip_strip* s, const char* input, const char* output, int width, int height, int components, int strip, float sigma, int threads, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int info, int packed, int luma, gradsnip_stats* stats)
+{
+    if (info > 0)
+    {
+        info_params(input, width, height, components, sigma, coef, delta, bound_lower, bound_upper, threads);
+    }
+    if (luma && (components > 1))
+    {
+        // the runs see the rows of the luma only
+        s->luma = (unsigned char)components;
+        components = 1;
+    }
+
+    if (bound_upper < bound_lower)
+    {
+        unsigned char bound = bound_lower;
+        bound_lower = bound_upper;
+        bound_upper = bound;
+    }
+    double sums[2 * components];
+    unsigned char threshold_global[components];
+    for (int k = 0; k < 2 * components; k++)
+    {
+        sums[k] = 0.0;
+    }
+    s->width = width;
+    s->components = components;
+    s->coef = coef;
+    s->delta = delta;
+    s->bound_lower = bound_lower;
+    s->bound_upper = bound_upper;
+    s->threshold_global = threshold_global;
+    s->sums = sums;
+
+    // First run: the sums of the gradient, second run: threshold and write the rows
+    double t = gradsnip_now();
+    if (!iir_gauss_blur_strips(width, height, components, sigma, strip, threads, gradsnip_strip_read, gradsnip_strip_value, s))
+    {
+        fprintf(stderr, "ERROR: not use memmory or failed to read %s\n", input);
+        return 3;
+    }
+    float gradient = image_threshold_gradsnip_value_sums(width, height, components, sums, threshold_global);
+    stats->blur = gradsnip_now() - t;
+
+    const char* ext = image_ext(output);
+    int pbm = (ext != NULL) && (strcasecmp(ext, ".pbm") == 0);
+    int bits = image_write_bits_mode(output, components, packed);
+    if (!image_write_fits(output, components, bits))
+    {
+        fprintf(stderr, "Failed to save %s.\n", output);
+        return 4;
+    }
+    // PGM/PPM/PBM rows are written one by one, PNG rows go into the bands of the encoder
+    s->output = image_open(output);
+    int ok = (s->output != NULL);
+    if (bits)
+    {
+        s->bits = (unsigned char*)malloc(image_bits_stride(width));
+        stats->allocated += image_bits_stride(width);
+        ok = ok && (s->bits != NULL);
+    }
+    if (ok && (bits ? pbm : image_write_pnm(output, components)))
+    {
+        ok = bits ? pbm_write_header(s->output, width, height) : pnm_write_header(s->output, width, height, components);
+    }
+    else if (ok)
+    {
+        s->png = image_png_begin(s->output, width, height, components, bits ? 1 : 8);
+        ok = (s->png != NULL);
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to save %s.\n", output);
+        return 4;
+    }
+    t = gradsnip_now();
+    if (!iir_gauss_blur_strips(width, height, components, sigma, strip, threads, gradsnip_strip_read, gradsnip_strip_apply, s))
+    {
+        fprintf(stderr, "ERROR: not use memmory or failed to read %s\n", input);
+        return 3;
+    }
+    float bwm = (double) s->count_black / ((double)width * height * components);
+    stats->apply = gradsnip_now() - t;
+    if (info > 0)
+    {
+        image_threshold_gradsnip_info(components, gradient, bwm, threshold_global);
+    }
+    stats->gradient = gradient;
+    stats->bwm = bwm;
+    memcpy(stats->threshold_global, threshold_global, components);
+
+    t = gradsnip_now();
+    ok = (s->png == NULL) || image_png_end(s->png);
+    s->png = NULL;
+    // flushed first, so a file that can't be written out is still discarded by the caller
+    ok = ok && !s->failed && (fflush(s->output) == 0);
+    if (ok)
+    {
+        ok = image_close(s->output);
+        s->output = NULL;
+    }
+    if (!ok)
+    {
+        fprintf(stderr, "Failed to save %s.\n", output);
+        return 4;
+    }
+    stats->encode = gradsnip_now() - t;
+
+    return 0;
+}
+
+// The stats: decode (stb_image only, PGM/PPM rows are read by the runs), blur (the first run with the statistics),
+// apply (the second run: blur, threshold and the rows written, PNG bands deflated as they fill) and encode (the end of
+// the file). Only the rows of a binary PGM/PPM file are read strip by strip, other inputs are decoded whole.
+// An output that fails half written is removed (unless it is the standard output).
+int gradsnip_strips(const char* input, const char* output, int strip, float sigma, int threads, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int info, int packed, int luma, gradsnip_stats* stats)
+{
+    gradsnip_strip s;
+    memset(&s, 0, sizeof(s));
+    unsigned char* pixels = NULL;
+    unsigned char* decoded = NULL;
+    int width = 0, height = 0, components = 1;
+    int retval = 0;
+    double t = gradsnip_now();
+    // the runs read the rows of a PGM/PPM file twice, the standard input is read into memory once
+    int stream = (strcmp(input, "-") == 0);
+    s.input = stream ? NULL : fopen(input, "rb");
+    if ((s.input != NULL) && pnm_read_header(s.input, &width, &height, &components))
+    {
+        s.offset = ftell(s.input);
+    }
+    else
+    {
+        if (s.input != NULL)
+        {
+            fclose(s.input);
+            s.input = NULL;
+        }
+        size_t capacity = 0;
+        s.image = stream ? image_read_stream(stdin, &width, &height, &components, &pixels, &capacity, &decoded) : stbi_load(input, &width, &height, &components, 0);
+        decoded = stream ? decoded : s.image;
+        if (s.image == NULL)
+        {
+            const char* reason = stbi_failure_reason();
+            fprintf(stderr, "Failed to load %s: %s.\n", input, (reason != NULL) ? reason : "bad PGM/PPM");
+            retval = 2;
+        }
+        stats->decode = gradsnip_now() - t;
+        stats->allocated += (s.image != NULL) ? (size_t)width * height * components : 0;
+    }
+    stats->width = width;
+    stats->height = height;
+    stats->components = components;
+    if (retval == 0)
+    {
+        retval = gradsnip_strips_run(&s, input, output, width, height, components, strip, sigma, threads, coef, delta, bound_lower, bound_upper, info, packed, luma, stats);
+    }
+
+    // every exit: the input, the buffers and what is left of the output (the encoder is aborted, the file removed)
+    free(s.samples);
+    free(pixels);
+    stbi_image_free(decoded);
+    if (s.input != NULL)
+    {
+        fclose(s.input);
+    }
+    if (s.png != NULL)
+    {
+        image_png_end(s.png);
+    }
+    free(s.bits);
+    if (s.output != NULL)
+    {
+        image_discard(s.output, output);
+    }
+    return retval;
+}
+
+// Batch mode: the pages go through three stages on their own threads, page N + 1 is loaded while page N is filtered
+// and page N - 1 is written. The image buffers of the stages and the float blur are kept and only grow.
+// Binary PGM/PPM input is mapped, not read, and PGM/PPM/PBM output is thresholded straight into the mapped file.
+#define GRADSNIP_BATCH_SLOTS 3
+
+enum { GRADSNIP_SLOT_FREE, GRADSNIP_SLOT_LOADED, GRADSNIP_SLOT_FILTERED };
+
+typedef struct
+{
+    int state;
+    int page;
+    int error;
+    int width, height, components;
+    unsigned char* image;      // mapped, pixels or decoded
+    image_map input;           // mapped binary PGM/PPM (read-only)
+    unsigned char* pixels;     // own buffer (PGM/PPM that can't be mapped, the result of a mapped one), kept for the next pages
+    size_t capacity;
+    unsigned char* decoded;    // decoded by stb_image
+    unsigned char* result;     // 8 bit result: the image, pixels, gray or the mapped output
+    int result_components;     // 1 for the luma of a color image (-y), the components of the image otherwise
+    unsigned char* gray;       // own buffer of the luma result, kept for the next pages
+    size_t gray_capacity;
+    image_map output;          // mapped PGM/PPM/PBM output
+    unsigned char* bits;       // packed 1 bit result, kept for the next pages
+    size_t bits_capacity;
+    int packed;
+    gradsnip_stats stats;
+} gradsnip_slot;
+
+typedef struct
+{
+    char** names;
+    int pages;
+    float sigma, coef, delta;
+    unsigned char bound_lower, bound_upper;
+    int threads, info, packed, fixed, luma, pyramid;
+    FILE* json;
+    gradsnip_slot slots[GRADSNIP_BATCH_SLOTS];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int error;
+} gradsnip_batch;
+
+static gradsnip_slot* gradsnip_batch_wait(gradsnip_batch* b, int page, int state)
+{
+    gradsnip_slot* slot = &b->slots[page % GRADSNIP_BATCH_SLOTS];
+    pthread_mutex_lock(&b->lock);
+    while ((slot->state != state) || ((state != GRADSNIP_SLOT_FREE) && (slot->page != page)))
+    {
+        pthread_cond_wait(&b->changed, &b->lock);
+    }
+    pthread_mutex_unlock(&b->lock);
+    return slot;
+}
+
+static void gradsnip_batch_done(gradsnip_batch* b, gradsnip_slot* slot, int page, int state)
+{
+    pthread_mutex_lock(&b->lock);
+    slot->page = page;
+    slot->state = state;
+    pthread_cond_broadcast(&b->changed);
+    pthread_mutex_unlock(&b->lock);
+}
 
-void usage(char* progname)
+static unsigned char* gradsnip_slot_buffer(unsigned char** buffer, size_t* capacity, size_t size)
 {
-    fprintf(stderr,
-        "%s %s %s\n",
-        "Usage:", progname, "[-h] [-i] [-s sigma] [-k coeff] [-d delta] [-l lower] [-u upper] input-file output.png\n"
-        "Grad (aka Gradient Snip) threshold an image and save it as PNG.\n"
-     );
+    if (size > *capacity)
+    {
+        free(*buffer);
+        *buffer = (unsigned char*)malloc(size);
+        *capacity = (*buffer != NULL) ? size : 0;
+    }
+    return *buffer;
 }
 
-void help(float sigma, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper)
+// Binary PGM/PPM are mapped (or read into the buffer of the slot if they can't be), anything else is decoded by stb_image;
+// "-" reads the next image from the standard input
+static int gradsnip_batch_load(const char* filename, gradsnip_slot* slot)
 {
-    fprintf(stderr,
-        "%s %f %s %f %s %f %s %d %s %d %s\n",
-        "  -s sigma     The sigma of the gauss normal distribution (number >= 0.5, default =", sigma, ").\n"
-        "               Larger values result in a stronger blur.\n"
-        "  -k coeff     The coefficient local threshold (number, default =", coef, ").\n"
-        "  -d delta     The regulator threshold (number, default =", delta, ").\n"
-        "  -l lower     The bound lower threshold (integer, default =", bound_lower, ").\n"
-        "  -u upper     The bound upper threshold (integer, default =", bound_upper, ").\n"
-        "  -i           info to stdout.\n"
-        "  -h           display this help and exit.\n"
-        "\n"
-        "You can use either sigma to specify the strengh of the blur.\n"
-        "\n"
-        "The performance is independent of the blur strengh (sigma). This tool is an\n"
-        "implementation of the paper \"Recursive implementaion of the Gaussian filter\"\n"
-        "by Ian T. Young and Lucas J. van Vliet.\n"
-        "\n"
-        "stb_image and stb_image_write by Sean Barrett and others is used to read and\n"
-        "write images.\n"
-    );
+    if (strcmp(filename, "-") == 0)
+    {
+        slot->image = image_read_stream(stdin, &slot->width, &slot->height, &slot->components, &slot->pixels, &slot->capacity, &slot->decoded);
+        if (slot->image == NULL)
+        {
+            const char* reason = stbi_failure_reason();
+            fprintf(stderr, "Failed to load %s: %s.\n", filename, (reason != NULL) ? reason : "bad PGM/PPM");
+        }
+        return (slot->image != NULL);
+    }
+    FILE* file = fopen(filename, "rb");
+    if ((file != NULL) && pnm_read_header(file, &slot->width, &slot->height, &slot->components))
+    {
+        size_t size = (size_t)slot->width * slot->height * slot->components;
+        slot->image = image_map_read(file, size, &slot->input);
+        if (slot->image != NULL)
+        {
+            fclose(file);
+            return 1;
+        }
+        int ok = (gradsnip_slot_buffer(&slot->pixels, &slot->capacity, size) != NULL) && (fread(slot->pixels, 1, size, file) == size);
+        fclose(file);
+        slot->image = slot->pixels;
+        if (!ok)
+        {
+            fprintf(stderr, "Failed to load %s.\n", filename);
+        }
+        return ok;
+    }
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    slot->decoded = stbi_load(filename, &slot->width, &slot->height, &slot->components, 0);
+    slot->image = slot->decoded;
+    if (slot->image == NULL)
+    {
+        fprintf(stderr, "Failed to load %s: %s.\n", filename, stbi_failure_reason());
+    }
+    return (slot->image != NULL);
+}
+
+static void* gradsnip_batch_loader(void* arg)
+{
+    gradsnip_batch* b = (gradsnip_batch*)arg;
+    for (int page = 0; page < b->pages; page++)
+    {
+        gradsnip_slot* slot = gradsnip_batch_wait(b, page, GRADSNIP_SLOT_FREE);
+        gradsnip_stats_init(&slot->stats, b->names[2 * page], b->names[2 * page + 1], "whole", b->sigma, b->coef, b->delta, b->bound_lower, b->bound_upper, b->threads, b->fixed, b->luma);
+        double t = gradsnip_now();
+        slot->error = gradsnip_batch_load(b->names[2 * page], slot) ? 0 : 2;
+        slot->stats.decode = gradsnip_now() - t;
+        if (slot->error == 0)
+        {
+            slot->stats.width = slot->width;
+            slot->stats.height = slot->height;
+            slot->stats.components = slot->components;
+            slot->stats.allocated = (slot->input.data == NULL) ? (size_t)slot->width * slot->height * slot->components : 0;
+        }
+        gradsnip_batch_done(b, slot, page, GRADSNIP_SLOT_LOADED);
+    }
+    return NULL;
+}
+
+static void* gradsnip_batch_writer(void* arg)
+{
+    gradsnip_batch* b = (gradsnip_batch*)arg;
+    for (int page = 0; page < b->pages; page++)
+    {
+        gradsnip_slot* slot = gradsnip_batch_wait(b, page, GRADSNIP_SLOT_FILTERED);
+        const char* output = b->names[2 * page + 1];
+        double t = gradsnip_now();
+        if (slot->output.data != NULL)
+        {
+            const char* ext = image_ext(output);
+            if (!image_map_close(&slot->output, slot->packed && (ext != NULL) && (strcasecmp(ext, ".pbm") == 0)) && (slot->error == 0))
+            {
+                fprintf(stderr, "Failed to save %s.\n", output);
+                slot->error = 4;
+            }
+            if (slot->error != 0)
+            {
+                unlink(output);
+            }
+        }
+        else if ((slot->error == 0) && ((slot->packed ? image_write_bits(output, slot->width, slot->height, slot->bits)
+            : image_write(output, slot->width, slot->height, slot->result_components, slot->result)) == 0))
+        {
+            fprintf(stderr, "Failed to save %s.\n", output);
+            slot->error = 4;
+        }
+        slot->stats.encode = (slot->error == 0) ? gradsnip_now() - t : 0.0;
+        slot->stats.error = slot->error;
+        gradsnip_stats_write(b->json, &slot->stats);
+        if (slot->error > b->error)
+        {
+            b->error = slot->error;
+        }
+        stbi_image_free(slot->decoded);
+        slot->decoded = NULL;
+        if (slot->input.data != NULL)
+        {
+            image_map_close(&slot->input, 0);
+        }
+        gradsnip_batch_done(b, slot, page, GRADSNIP_SLOT_FREE);
+    }
+    return NULL;
+}
+
+int gradsnip_batch_run(char** names, int pages, float sigma, int threads, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int info, int packed, int fixed, int luma, int pyramid, FILE* json)
+{
+    if (bound_upper < bound_lower)
+    {
+        unsigned char bound = bound_lower;
+        bound_lower = bound_upper;
+        bound_upper = bound;
+    }
+    gradsnip_batch b;
+    memset(&b, 0, sizeof(b));
+    b.names = names;
+    b.pages = pages;
+    b.sigma = sigma;
+    b.coef = coef;
+    b.delta = delta;
+    b.bound_lower = bound_lower;
+    b.bound_upper = bound_upper;
+    b.threads = threads;
+    b.info = info;
+    b.packed = packed;
+    b.fixed = fixed;
+    b.luma = luma;
+    b.pyramid = pyramid;
+    b.json = json;
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.changed, NULL);
+
+    pthread_t loader, writer;
+    if (pthread_create(&loader, NULL, gradsnip_batch_loader, &b) != 0)
+    {
+        fprintf(stderr, "ERROR: no threads\n");
+        return 3;
+    }
+    if (pthread_create(&writer, NULL, gradsnip_batch_writer, &b) != 0)
+    {
+        fprintf(stderr, "ERROR: no threads\n");
+        pthread_join(loader, NULL);
+        return 3;
+    }
+
+    // Filter on this thread, the blur (float or 16 bit fixed point) of the context only grows
+    size_t blur_sample = fixed ? sizeof(unsigned short) : sizeof(float);
+    image_threshold_gradsnip_context ctx;
+    image_threshold_gradsnip_context_init(&ctx, sigma, threads, coef, delta, bound_lower, bound_upper, fixed, pyramid, luma);
+    for (int page = 0; page < pages; page++)
+    {
+        gradsnip_slot* slot = gradsnip_batch_wait(&b, page, GRADSNIP_SLOT_LOADED);
+        // the blur and the result have one component for the luma
+        int components = luma ? 1 : slot->components;
+        slot->result_components = components;
+        slot->packed = (slot->error == 0) && image_write_bits_mode(names[2 * page + 1], components, packed);
+        if (slot->error == 0)
+        {
+            size_t size = (size_t)slot->width * slot->height * components;
+            // the result: the mapped output file, or the packed rows, the image itself, pixels (for a read-only mapped image)
+            // or gray (for the luma, the image is read while the result is written)
+            unsigned char* mapped = image_map_result(names[2 * page + 1], slot->width, slot->height, components, slot->packed, &slot->input, &slot->output);
+            size_t stride = (mapped != NULL) ? (size_t)(slot->width + 7) / 8 : image_bits_stride(slot->width);
+            unsigned char* bits = NULL;
+            slot->result = NULL;
+            if (slot->packed)
+            {
+                if ((mapped == NULL) && (stride * slot->height > slot->bits_capacity))
+                {
+                    free(slot->bits);
+                    slot->bits = (unsigned char*)malloc(stride * slot->height);
+                    slot->bits_capacity = (slot->bits != NULL) ? stride * slot->height : 0;
+                }
+                bits = (mapped != NULL) ? mapped : ((slot->bits != NULL) ? slot->bits + 1 : NULL);
+                slot->stats.allocated += (mapped == NULL) ? stride * slot->height : 0;
+            }
+            else if (mapped != NULL)
+            {
+                slot->result = mapped;
+            }
+            else if (components != slot->components)
+            {
+                slot->result = gradsnip_slot_buffer(&slot->gray, &slot->gray_capacity, size);
+                slot->stats.allocated += size;
+            }
+            else
+            {
+                slot->result = (slot->input.data != NULL) ? gradsnip_slot_buffer(&slot->pixels, &slot->capacity, size) : slot->image;
+                slot->stats.allocated += (slot->input.data != NULL) ? size : 0;
+            }
+            slot->stats.allocated += size * blur_sample;
+            if (slot->packed ? (bits == NULL) : (slot->result == NULL))
+            {
+                fprintf(stderr, "ERROR: not use memmory\n");
+                slot->error = 3;
+            }
+            else
+            {
+                if (info > 0)
+                {
+                    info_params(names[2 * page], slot->width, slot->height, slot->components, sigma, coef, delta, bound_lower, bound_upper, threads);
+                    if (fixed)
+                    {
+                        fprintf(stderr, "INFO: blur 16 bit fixed point, max deviation %f (plus the float rounding noise)\n", iir_gauss_blur_fixed_deviation(sigma));
+                    }
+                    if (pyramid)
+                    {
+                        info_pyramid(sigma);
+                    }
+                    if (components != slot->components)
+                    {
+                        fprintf(stderr, "INFO: luma of %d components\n", slot->components);
+                    }
+                }
+                if (slot->packed && (mapped == NULL))
+                {
+                    // the result goes straight into the packed rows after their filter byte
+                    for (int y = 0; y < slot->height; y++)
+                    {
+                        slot->bits[y * stride] = 0;
+                    }
+                }
+                // the blur with the statistics of the global threshold, then the threshold itself
+                double t = gradsnip_now();
+                float gradient = image_threshold_gradsnip_context_value(&ctx, slot->width, slot->height, slot->components, slot->image, 0, 0);
+                slot->stats.blur = gradsnip_now() - t;
+                slot->stats.pyramid = pyramid ? iir_gauss_blur_pyramid_factor(sigma) : 1;
+                if (gradient < 0.0f)
+                {
+                    fprintf(stderr, "ERROR: not use memmory\n");
+                    slot->error = 3;
+                }
+                else
+                {
+                    t = gradsnip_now();
+                    float bwm = image_threshold_gradsnip_context_apply(&ctx, slot->width, slot->height, slot->components, slot->image, 0, 0, slot->result, 0, bits, stride);
+                    slot->stats.apply = gradsnip_now() - t;
+                    if (info > 0)
+                    {
+                        image_threshold_gradsnip_info(components, gradient, bwm, ctx.threshold_global);
+                    }
+                    slot->stats.gradient = gradient;
+                    slot->stats.bwm = bwm;
+                    memcpy(slot->stats.threshold_global, ctx.threshold_global, components);
+                }
+            }
+        }
+        if (page == pages - 1)
+        {
+            // nothing left to filter: don't keep the blur while the last page is written
+            image_threshold_gradsnip_context_free(&ctx);
+        }
+        gradsnip_batch_done(&b, slot, page, GRADSNIP_SLOT_FILTERED);
+    }
+
+    pthread_join(loader, NULL);
+    pthread_join(writer, NULL);
+    for (int k = 0; k < GRADSNIP_BATCH_SLOTS; k++)
+    {
+        free(b.slots[k].pixels);
+        free(b.slots[k].gray);
+        free(b.slots[k].bits);
+    }
+    pthread_cond_destroy(&b.changed);
+    pthread_mutex_destroy(&b.lock);
+
+    return b.error;
+}
+
+// Adds a page to the names of a batch, 0 if there is no memory
+static int gradsnip_batch_add(char*** names, int* count, int* capacity, const char* input, const char* output)
+{
+    if (*count + 2 > *capacity)
+    {
+        int grown = (*capacity > 0) ? 2 * *capacity : 64;
+        char** larger = (char**)realloc(*names, grown * sizeof(char*));
+        if (larger == NULL)
+        {
+            return 0;
+        }
+        *names = larger;
+        *capacity = grown;
+    }
+    char* in = strdup(input);
+    char* out = strdup(output);
+    if ((in == NULL) || (out == NULL))
+    {
+        free(in);
+        free(out);
+        return 0;
+    }
+    (*names)[(*count)++] = in;
+    (*names)[(*count)++] = out;
+    return 1;
+}
+
+// Batch list: an input and an output filename per line (separated by white space), lines starting with # are skipped,
+// followed by the `pairs` input and output filenames of the command line; NULL if the list can't be read
+void gradsnip_batch_free(char** names, int count)
+{
+    for (int k = 0; (names != NULL) && (k < count); k++)
+    {
+        free(names[k]);
+    }
+    free(names);
+}
+
+char** gradsnip_batch_list(const char* filename, char** pairs, int pairs_count, int* count)
+{
+    FILE* file = fopen(filename, "r");
+    if (file == NULL)
+    {
+        return NULL;
+    }
+    // allocated up front so that an empty list is not taken for a failure
+    int n = 0, capacity = 64;
+    char** names = (char**)malloc(capacity * sizeof(char*));
+    int ok = (names != NULL);
+    char* line = NULL;
+    size_t line_size = 0;
+    while (ok && (getline(&line, &line_size, file) != -1))
+    {
+        char* save = NULL;
+        char* input = strtok_r(line, " \t\r\n", &save);
+        char* output = strtok_r(NULL, " \t\r\n", &save);
+        if ((input == NULL) || (input[0] == '#'))
+        {
+            continue;
+        }
+        if (output == NULL)
+        {
+            fprintf(stderr, "ERROR: no output for %s in %s\n", input, filename);
+            continue;
+        }
+        ok = gradsnip_batch_add(&names, &n, &capacity, input, output);
+    }
+    for (int k = 0; ok && (k + 1 < pairs_count); k += 2)
+    {
+        ok = gradsnip_batch_add(&names, &n, &capacity, pairs[k], pairs[k + 1]);
+    }
+    free(line);
+    ok = !ferror(file) && ok;
+    fclose(file);
+    if (!ok)
+    {
+        gradsnip_batch_free(names, n);
+        return NULL;
+    }
+    *count = n;
+    return names;
+}
+
+// Sweep: a list of values for a parameter, "0.5,0.75,1", ranges "0.5:1:0.25" (from:to:step, step 1 if left out) or both
+#define GRADSNIP_SWEEP_MAX 256
+
+enum { GRADSNIP_SIGMA, GRADSNIP_COEF, GRADSNIP_DELTA, GRADSNIP_LOWER, GRADSNIP_UPPER, GRADSNIP_PARAMS };
+
+typedef struct
+{
+    float values[GRADSNIP_SWEEP_MAX];
+    int count;
+} gradsnip_sweep_param;
+
+// Returns the number of values, 0 for a bad list
+int gradsnip_values(const char* arg, gradsnip_sweep_param* param)
+{
+    int n = 0;
+    const char* p = arg;
+    while (*p != '\0')
+    {
+        char* end;
+        float from = strtof(p, &end), to, step = 1.0f;
+        if (end == p)
+        {
+            return 0;
+        }
+        to = from;
+        if (*end == ':')
+        {
+            p = end + 1;
+            to = strtof(p, &end);
+            if ((end == p) || (to < from))
+            {
+                return 0;
+            }
+            if (*end == ':')
+            {
+                p = end + 1;
+                step = strtof(p, &end);
+                if ((end == p) || !(step > 0.0f))
+                {
+                    return 0;
+                }
+            }
+        }
+        int count = (int)((to - from) / step + 1e-4f) + 1;
+        for (int k = 0; k < count; k++)
+        {
+            if (n >= GRADSNIP_SWEEP_MAX)
+            {
+                return 0;
+            }
+            param->values[n++] = from + k * step;
+        }
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end != '\0')
+        {
+            return 0;
+        }
+        p = end;
+    }
+    param->count = n;
+    return n;
+}
+
+// out.png -> out_s10_k0.75_d0_l0_u255.png
+char* gradsnip_sweep_name(const char* output, float sigma, float coef, float delta, int lower, int upper)
+{
+    const char* ext = strrchr(output, '.');
+    const char* slash = strrchr(output, '/');
+    if ((ext == NULL) || ((slash != NULL) && (ext < slash)))
+    {
+        ext = output + strlen(output);
+    }
+    size_t size = strlen(output) + 128;
+    char* name = (char*)malloc(size);
+    if (name != NULL)
+    {
+        snprintf(name, size, "%.*s_s%g_k%g_d%g_l%d_u%d%s", (int)(ext - output), output, sigma, coef, delta, lower, upper, ext);
+    }
+    return name;
+}
+
+// Every page is loaded once and blurred (with the statistics of the value step) once per sigma,
+// only the apply step runs for every setting. A table of the BW metrics goes to stdout.
+int gradsnip_sweep(char** names, int pages, const gradsnip_sweep_param* params, int threads, int info, int packed, int fixed, int luma, int pyramid, FILE* json)
+{
+    const gradsnip_sweep_param* sigmas = &params[GRADSNIP_SIGMA];
+    const gradsnip_sweep_param* coefs = &params[GRADSNIP_COEF];
+    const gradsnip_sweep_param* deltas = &params[GRADSNIP_DELTA];
+    const gradsnip_sweep_param* lowers = &params[GRADSNIP_LOWER];
+    const gradsnip_sweep_param* uppers = &params[GRADSNIP_UPPER];
+    int error = 0;
+    printf("input\toutput\tsigma\tcoeff\tdelta\tlower\tupper\tgradient\tbwm\n");
+    for (int page = 0; page < pages; page++)
+    {
+        const char* input = names[2 * page];
+        const char* output = names[2 * page + 1];
+        gradsnip_slot slot;
+        memset(&slot, 0, sizeof(slot));
+        double t = gradsnip_now();
+        if (!gradsnip_batch_load(input, &slot))
+        {
+            gradsnip_stats_init(&slot.stats, input, output, "sweep", sigmas->values[0], coefs->values[0], deltas->values[0], (unsigned char)(long)lowers->values[0], (unsigned char)(long)uppers->values[0], threads, fixed, luma);
+            slot.stats.error = 2;
+            gradsnip_stats_write(json, &slot.stats);
+            error = (error > 2) ? error : 2;
+            continue;
+        }
+        double decode = gradsnip_now() - t;
+        // the blur and the result have one component for the luma
+        int width = slot.width, height = slot.height, components = luma ? 1 : slot.components;
+        size_t size = (size_t)width * height * components;
+        size_t stride = image_bits_stride(width);
+        int bits_mode = image_write_bits_mode(output, components, packed);
+        const char* ext = image_ext(output);
+        if (!image_write_fits(output, components, bits_mode))
+        {
+            fprintf(stderr, "Failed to save %s.\n", output);
+            error = (error > 4) ? error : 4;
+            free(slot.pixels);
+            stbi_image_free(slot.decoded);
+            if (slot.input.data != NULL)
+            {
+                image_map_close(&slot.input, 0);
+            }
+            continue;
+        }
+        unsigned char* result = bits_mode ? (unsigned char*)malloc(stride * height) : (unsigned char*)malloc(size);
+        size_t allocated = ((slot.input.data == NULL) ? (size_t)width * height * slot.components : 0) + size * (fixed ? sizeof(unsigned short) : sizeof(float)) + (bits_mode ? stride * height : size);
+        if (result == NULL)
+        {
+            fprintf(stderr, "ERROR: not use memmory\n");
+            error = (error > 3) ? error : 3;
+        }
+        for (int ks = 0; (ks < sigmas->count) && (result != NULL); ks++)
+        {
+            // a context per sigma: the apply step runs for every setting on its blur
+            float sigma = sigmas->values[ks];
+            image_threshold_gradsnip_context ctx;
+            image_threshold_gradsnip_context_init(&ctx, sigma, threads, coefs->values[0], deltas->values[0], 0, 255, fixed, pyramid, luma);
+            unsigned char* threshold_global = ctx.threshold_global;
+            t = gradsnip_now();
+            float gradient = image_threshold_gradsnip_context_value(&ctx, width, height, slot.components, slot.image, 0, 0);
+            double blur_time = gradsnip_now() - t;
+            if (gradient < 0.0f)
+            {
+                fprintf(stderr, "ERROR: not use memmory\n");
+                error = (error > 3) ? error : 3;
+                image_threshold_gradsnip_context_free(&ctx);
+                break;
+            }
+            if (info > 0)
+            {
+                info_params(input, width, height, slot.components, sigma, coefs->values[0], deltas->values[0], lowers->values[0], uppers->values[0], threads);
+                if (pyramid)
+                {
+                    info_pyramid(sigma);
+                }
+                for (int c = 0; c < components; c++)
+                {
+                    fprintf(stderr, "INFO: component %d : threshold %d\n", c, threshold_global[c]);
+                }
+            }
+            for (int kc = 0; kc < coefs->count; kc++)
+            for (int kd = 0; kd < deltas->count; kd++)
+            for (int kl = 0; kl < lowers->count; kl++)
+            for (int ku = 0; ku < uppers->count; ku++)
+            {
+                float coef = coefs->values[kc], delta = deltas->values[kd];
+                unsigned char bound_lower = (unsigned char)(long)lowers->values[kl];
+                unsigned char bound_upper = (unsigned char)(long)uppers->values[ku];
+                if (bound_upper < bound_lower)
+                {
+                    unsigned char bound = bound_lower;
+                    bound_lower = bound_upper;
+                    bound_upper = bound;
+                }
+                // the apply step writes into its own result (or the mapped output), the image stays as it is for the next setting
+                char* name = gradsnip_sweep_name(output, sigma, coef, delta, bound_lower, bound_upper);
+                image_map map;
+                unsigned char* mapped = (name != NULL) ? image_map_result(name, width, height, components, bits_mode, &slot.input, &map) : NULL;
+                unsigned char* target = (mapped != NULL) ? mapped : result;
+                size_t target_stride = (mapped != NULL) ? (size_t)(width + 7) / 8 : stride;
+                if (bits_mode && (mapped == NULL))
+                {
+                    for (int y = 0; y < height; y++)
+                    {
+                        result[y * stride] = 0;
+                    }
+                    target = result + 1;
+                }
+                gradsnip_stats stats;
+                gradsnip_stats_init(&stats, input, output, "sweep", sigma, coef, delta, bound_lower, bound_upper, threads, fixed, luma);
+                t = gradsnip_now();
+                ctx.coef = coef;
+                ctx.delta = delta;
+                ctx.bound_lower = bound_lower;
+                ctx.bound_upper = bound_upper;
+                float bwm = image_threshold_gradsnip_context_apply(&ctx, width, height, slot.components, slot.image, 0, 0,
+                    bits_mode ? NULL : target, 0, bits_mode ? target : NULL, target_stride);
+                stats.apply = gradsnip_now() - t;
+
+                t = gradsnip_now();
+                int saved = (mapped != NULL) ? image_map_close(&map, bits_mode && (ext != NULL) && (strcasecmp(ext, ".pbm") == 0))
+                    : ((name != NULL) && (bits_mode ? image_write_bits(name, width, height, result) : image_write(name, width, height, components, result)));
+                if (!saved)
+                {
+                    fprintf(stderr, "Failed to save %s.\n", (name != NULL) ? name : output);
+                    error = (error > 4) ? error : 4;
+                    stats.error = 4;
+                }
+                else
+                {
+                    stats.encode = gradsnip_now() - t;
+                    printf("%s\t%s\t%g\t%g\t%g\t%d\t%d\t%f\t%f\n", input, name, sigma, coef, delta, bound_lower, bound_upper, gradient, bwm);
+                }
+                // the page is decoded once and blurred once per sigma: every setting shows those times
+                stats.output = (name != NULL) ? name : output;
+                stats.width = width;
+                stats.height = height;
+                stats.components = slot.components;
+                stats.pyramid = pyramid ? iir_gauss_blur_pyramid_factor(sigma) : 1;
+                stats.gradient = gradient;
+                stats.bwm = bwm;
+                memcpy(stats.threshold_global, threshold_global, components);
+                stats.decode = decode;
+                stats.blur = blur_time;
+                stats.allocated = allocated;
+                gradsnip_stats_write(json, &stats);
+                free(name);
+            }
+            image_threshold_gradsnip_context_free(&ctx);
+        }
+        free(result);
+        free(slot.pixels);
+        stbi_image_free(slot.decoded);
+        if (slot.input.data != NULL)
+        {
+            image_map_close(&slot.input, 0);
+        }
+    }
+
+    return error;
+}
+
+// Interactive mode (-I): the page is loaded and blurred once, the blur and the statistics of the global threshold stay
+// in a context. Commands on stdin change the settings and the view, "w" thresholds the tiles of the view that are not
+// up to date (or a preview of the view at 1/factor) and writes the view. A line per written view goes to stdout.
+#define GRADSNIP_TILE 256
+
+// Packs 8 bit gray rows (0 or 255) into the rows of image_write_bits(), the padding is black
+static void gradsnip_pack_rows(int width, int height, const unsigned char* image, unsigned char* bits)
+{
+    size_t stride = image_bits_stride(width);
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* row = image + (size_t)y * width;
+        unsigned char* out = bits + y * stride;
+        out[0] = 0;
+        for (int x = 0; x < width; x += 8)
+        {
+            unsigned int acc = 0;
+            for (int k = 0; k < 8; k++)
+            {
+                acc = (acc << 1) | ((x + k < width) && (row[x + k] != 0));
+            }
+            out[1 + x / 8] = (unsigned char)acc;
+        }
+    }
 }
 
-unsigned char* image_copy(unsigned int width, unsigned int height, unsigned char components, unsigned char* image)
+int gradsnip_interactive(const char* input, const char* output, float sigma, int threads, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int info, int packed, int fixed, int luma, int pyramid)
 {
-    size_t image_size = height * width * components;
-    unsigned char* dest = (unsigned char*)malloc(image_size * sizeof(unsigned char));
-    if (dest != NULL)
+    gradsnip_slot slot;
+    memset(&slot, 0, sizeof(slot));
+    if (!gradsnip_batch_load(input, &slot))
+    {
+        return 2;
+    }
+    // the result has one component for the luma
+    int width = slot.width, height = slot.height, components = luma ? 1 : slot.components;
+    size_t size = (size_t)width * height * components;
+    image_threshold_gradsnip_context ctx;
+    image_threshold_gradsnip_context_init(&ctx, sigma, threads, coef, delta, bound_lower, bound_upper, fixed, pyramid, luma);
+    image_threshold_gradsnip_tiles tiles;
+    image_threshold_gradsnip_tiles_init(&tiles, GRADSNIP_TILE);
+    unsigned char* result = (unsigned char*)malloc(size);
+    unsigned char* view = (unsigned char*)malloc(size);
+    unsigned char* bits = (unsigned char*)malloc(image_bits_stride(width) * height);
+    int error = 0;
+    float gradient = -1.0f;
+    if ((result != NULL) && (view != NULL) && (bits != NULL))
+    {
+        gradient = image_threshold_gradsnip_context_value(&ctx, width, height, slot.components, slot.image, 0, 0);
+    }
+    if (gradient < 0.0f)
+    {
+        fprintf(stderr, "ERROR: not use memmory\n");
+        error = 3;
+    }
+    else
+    {
+        if (info > 0)
+        {
+            info_params(input, width, height, slot.components, sigma, coef, delta, bound_lower, bound_upper, threads);
+            if (pyramid)
+            {
+                info_pyramid(sigma);
+            }
+            fprintf(stderr, "INFO: gradient %f\n", gradient);
+            for (int c = 0; c < components; c++)
+            {
+                fprintf(stderr, "INFO: component %d : threshold %d\n", c, ctx.threshold_global[c]);
+            }
+        }
+        printf("output\tx\ty\twidth\theight\tfactor\tcoeff\tdelta\tlower\tupper\ttiles\tbwm\tapply_ms\twrite_ms\n");
+        fflush(stdout);
+    }
+
+    // the view: the whole page at full size to start with
+    unsigned int x = 0, y = 0, w = width, h = height, factor = 1;
+    int lower = ctx.bound_lower, upper = ctx.bound_upper;
+    char* line = NULL;
+    size_t line_size = 0;
+    while ((gradient >= 0.0f) && (getline(&line, &line_size, stdin) != -1))
     {
-        for (size_t i = 0; i < image_size; i++)
+        char* args[6];
+        int n = 0;
+        char* save = NULL;
+        for (char* p = strtok_r(line, " \t\r\n", &save); (p != NULL) && (n < 6); p = strtok_r(NULL, " \t\r\n", &save))
+        {
+            args[n++] = p;
+        }
+        if ((n == 0) || (args[0][0] == '#'))
+        {
+            continue;
+        }
+        if ((strcmp(args[0], "w") == 0) && (n <= 2) && ((n == 1) || (strcmp(args[1], "-") != 0)))
+        {
+            const char* name = (n == 2) ? args[1] : output;
+            int vw = (w - 1) / factor + 1, vh = (h - 1) / factor + 1;
+            size_t line_bytes = (size_t)vw * components;
+            int count = 0;
+            float bwm;
+            double t = gradsnip_now();
+            if (factor > 1)
+            {
+                // the preview: every factor-th pixel of the view with the full size blur, no tiles
+                bwm = image_threshold_gradsnip_context_apply_region(&ctx, slot.image, 0, 0, x, y, w, h, factor, view, 0, NULL, 0);
+            }
+            else
+            {
+                count = image_threshold_gradsnip_context_apply_tiles(&ctx, &tiles, slot.image, 0, 0, x, y, w, h, result, 0, NULL, 0);
+                if (count < 0)
+                {
+                    fprintf(stderr, "ERROR: not use memmory\n");
+                    error = 3;
+                    break;
+                }
+                size_t count_black = 0;
+                for (int j = 0; j < vh; j++)
+                {
+                    unsigned char* row = view + j * line_bytes;
+                    memcpy(row, result + ((size_t)(y + j) * width + x) * components, line_bytes);
+                    for (size_t i = 0; i < line_bytes; i++)
+                    {
+                        count_black += (row[i] == 0);
+                    }
+                }
+                bwm = (double)count_black / ((double)line_bytes * vh);
+            }
+            double apply_time = gradsnip_now() - t;
+
+            t = gradsnip_now();
+            int saved;
+            if (image_write_bits_mode(name, components, packed))
+            {
+                gradsnip_pack_rows(vw, vh, view, bits);
+                saved = image_write_bits(name, vw, vh, bits);
+            }
+            else
+            {
+                saved = image_write(name, vw, vh, components, view);
+            }
+            if (!saved)
+            {
+                fprintf(stderr, "Failed to save %s.\n", name);
+                error = 4;
+                continue;
+            }
+            printf("%s\t%u\t%u\t%u\t%u\t%u\t%g\t%g\t%d\t%d\t%d\t%f\t%.3f\t%.3f\n", name, x, y, w, h, factor, ctx.coef, ctx.delta, ctx.bound_lower, ctx.bound_upper,
+                count, bwm, apply_time * 1000.0, (gradsnip_now() - t) * 1000.0);
+            fflush(stdout);
+            continue;
+        }
+
+        // the other commands take numbers
+        double v[4] = {0.0, 0.0, width, height};
+        int ok = (n <= 5);
+        for (int k = 1; (k < n) && ok; k++)
+        {
+            char* end;
+            v[k - 1] = strtod(args[k], &end);
+            ok = (end != args[k]) && (*end == '\0');
+        }
+        if (ok && (strcmp(args[0], "q") == 0) && (n == 1))
+        {
+            break;
+        }
+        else if (ok && (strcmp(args[0], "k") == 0) && (n == 2))
+        {
+            ctx.coef = (float)v[0];
+        }
+        else if (ok && (strcmp(args[0], "d") == 0) && (n == 2))
         {
-            dest[i] = image[i];
+            ctx.delta = (float)v[0];
+        }
+        else if (ok && ((strcmp(args[0], "l") == 0) || (strcmp(args[0], "u") == 0)) && (n == 2))
+        {
+            int bound = (v[0] < 0.0) ? 0 : ((v[0] > 255.0) ? 255 : (int)v[0]);
+            *((args[0][0] == 'l') ? &lower : &upper) = bound;
+            ctx.bound_lower = (unsigned char)((lower < upper) ? lower : upper);
+            ctx.bound_upper = (unsigned char)((lower < upper) ? upper : lower);
+        }
+        else if (ok && (strcmp(args[0], "v") == 0) && ((n == 1) || (n == 5)))
+        {
+            // the view is clipped to the page, one that starts outside of it is the whole page
+            if ((v[0] < 0.0) || (v[1] < 0.0) || (v[0] >= width) || (v[1] >= height) || (v[2] < 1.0) || (v[3] < 1.0))
+            {
+                v[0] = 0.0;
+                v[1] = 0.0;
+                v[2] = width;
+                v[3] = height;
+            }
+            x = (unsigned int)v[0];
+            y = (unsigned int)v[1];
+            w = (v[2] < width - x) ? (unsigned int)v[2] : width - x;
+            h = (v[3] < height - y) ? (unsigned int)v[3] : height - y;
+        }
+        else if (ok && (strcmp(args[0], "z") == 0) && (n == 2))
+        {
+            factor = (v[0] > 1.0) ? (unsigned int)((v[0] < 65536.0) ? v[0] : 65536.0) : 1;
+        }
+        else
+        {
+            fprintf(stderr, "ERROR: bad command %s\n", args[0]);
         }
     }
-    return dest;
+
+    free(line);
+    free(result);
+    free(view);
+    free(bits);
+    image_threshold_gradsnip_tiles_free(&tiles);
+    image_threshold_gradsnip_context_free(&ctx);
+    free(slot.pixels);
+    stbi_image_free(slot.decoded);
+    if (slot.input.data != NULL)
+    {
+        image_map_close(&slot.input, 0);
+    }
+    return error;
 }
 
 int main(int argc, char** argv)
@@ -67,9 +1933,31 @@ int main(int argc, char** argv)
     float delta = 0.0f;
     unsigned char bound_lower = 0;
     unsigned char bound_upper = 255;
+    gradsnip_sweep_param params[GRADSNIP_PARAMS];
+    params[GRADSNIP_SIGMA].values[0] = sigma;
+    params[GRADSNIP_COEF].values[0] = coef;
+    params[GRADSNIP_DELTA].values[0] = delta;
+    params[GRADSNIP_LOWER].values[0] = bound_lower;
+    params[GRADSNIP_UPPER].values[0] = bound_upper;
+    for (int k = 0; k < GRADSNIP_PARAMS; k++)
+    {
+        params[k].count = 1;
+    }
+    int sweep = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = (cpus > 0) ? (int)cpus : 1;
+    int strip = -1;
+    char* list = NULL;
+    int packed = 0;
+    int fixed = 0;
+    int luma = 0;
+    int pyramid = 0;
+    int interactive = 0;
+    char* stats = NULL;
+    char format[8];
 
     int opt;
-    while ( (opt = getopt(argc, argv, "is:k:d:l:u:h")) != -1 )
+    while ( (opt = getopt(argc, argv, "is:k:d:l:u:t:r:b:1qpyj:f:z:Ih")) != -1 )
     {
         switch(opt)
         {
@@ -77,23 +1965,98 @@ int main(int argc, char** argv)
                 info = 1;
                 break;
             case 's':
-                sigma = strtof(optarg, NULL);
+                if (gradsnip_values(optarg, &params[GRADSNIP_SIGMA]) < 1)
+                {
+                    fprintf(stderr, "ERROR: bad value(s) %s\n", optarg);
+                    return 1;
+                }
+                sigma = params[GRADSNIP_SIGMA].values[0];
+                sweep |= (params[GRADSNIP_SIGMA].count > 1);
                 break;
             case 'k':
-                coef = strtof(optarg, NULL);
+                if (gradsnip_values(optarg, &params[GRADSNIP_COEF]) < 1)
+                {
+                    fprintf(stderr, "ERROR: bad value(s) %s\n", optarg);
+                    return 1;
+                }
+                coef = params[GRADSNIP_COEF].values[0];
+                sweep |= (params[GRADSNIP_COEF].count > 1);
                 break;
             case 'd':
-                delta = strtof(optarg, NULL);
+                if (gradsnip_values(optarg, &params[GRADSNIP_DELTA]) < 1)
+                {
+                    fprintf(stderr, "ERROR: bad value(s) %s\n", optarg);
+                    return 1;
+                }
+                delta = params[GRADSNIP_DELTA].values[0];
+                sweep |= (params[GRADSNIP_DELTA].count > 1);
                 break;
             case 'l':
-                bound_lower = strtol(optarg, NULL, 10);
+                if (gradsnip_values(optarg, &params[GRADSNIP_LOWER]) < 1)
+                {
+                    fprintf(stderr, "ERROR: bad value(s) %s\n", optarg);
+                    return 1;
+                }
+                bound_lower = (unsigned char)(long)params[GRADSNIP_LOWER].values[0];
+                sweep |= (params[GRADSNIP_LOWER].count > 1);
                 break;
             case 'u':
-                bound_upper = strtol(optarg, NULL, 10);
+                if (gradsnip_values(optarg, &params[GRADSNIP_UPPER]) < 1)
+                {
+                    fprintf(stderr, "ERROR: bad value(s) %s\n", optarg);
+                    return 1;
+                }
+                bound_upper = (unsigned char)(long)params[GRADSNIP_UPPER].values[0];
+                sweep |= (params[GRADSNIP_UPPER].count > 1);
+                break;
+            case 't':
+                threads = strtol(optarg, NULL, 10);
+                break;
+            case 'r':
+                strip = strtol(optarg, NULL, 10);
+                break;
+            case 'b':
+                list = optarg;
+                break;
+            case '1':
+                packed = 1;
+                break;
+            case 'q':
+                fixed = 1;
+                break;
+            case 'p':
+                pyramid = 1;
+                break;
+            case 'y':
+                luma = 1;
+                break;
+            case 'j':
+                stats = optarg;
+                break;
+            case 'f':
+                if ((strcasecmp(optarg, "png") != 0) && (strcasecmp(optarg, "pnm") != 0) && (strcasecmp(optarg, "pgm") != 0)
+                    && (strcasecmp(optarg, "ppm") != 0) && (strcasecmp(optarg, "pbm") != 0))
+                {
+                    fprintf(stderr, "ERROR: bad format %s\n", optarg);
+                    return 1;
+                }
+                snprintf(format, sizeof(format), ".%s", optarg);
+                image_format = format;
+                break;
+            case 'z':
+                image_png_level = strtol(optarg, NULL, 10);
+                if ((image_png_level < 0) || (image_png_level > 9))
+                {
+                    fprintf(stderr, "ERROR: bad level %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'I':
+                interactive = 1;
                 break;
             case 'h':
                 usage(argv[0]);
-                help(sigma, coef, delta, bound_lower, bound_upper);
+                help(sigma, coef, delta, bound_lower, bound_upper, threads, strip, image_png_level);
                 return 0;
             default:
                 usage(argv[0]);
@@ -101,55 +2064,103 @@ int main(int argc, char** argv)
         }
     }
 
-    // Need at least two filenames after the last option
-    if (argc < optind + 2)
+    image_png_threads = threads;
+
+    // Need at least two filenames after the last option (pairs of input and output), or a batch list (the pairs of the
+    // command line follow its pages); the list is read first, an input without an output is named
+    char** names = argv + optind;
+    int count = argc - optind;
+    int odd = (count % 2 != 0);
+    if (list != NULL)
+    {
+        names = gradsnip_batch_list(list, argv + optind, count, &count);
+        if (names == NULL)
+        {
+            fprintf(stderr, "Failed to load %s.\n", list);
+            return 2;
+        }
+    }
+    if ((count < 2) || (count % 2 != 0) || odd)
     {
+        if (odd)
+        {
+            fprintf(stderr, "ERROR: no output file for %s\n", argv[argc - 1]);
+        }
         usage(argv[0]);
+        if (names != argv + optind)
+        {
+            gradsnip_batch_free(names, count);
+        }
         return 1;
     }
 
-    int width = 0, height = 0, components = 1;
-    unsigned char* image = stbi_load(argv[optind], &width, &height, &components, 0);
-    if (image == NULL)
+    if (sweep && (strip >= 0))
     {
-        fprintf(stderr, "Failed to load %s: %s.\n", argv[optind], stbi_failure_reason());
-        return 2;
+        fprintf(stderr, "ERROR: a sweep can't run in strips\n");
+        return 1;
     }
-
-    unsigned char* blur = image_copy(width, height, components, image);
-    if (blur == NULL)
+    if (interactive && ((count != 2) || sweep || (strip >= 0) || (stats != NULL) || (strcmp(names[0], "-") == 0) || (strcmp(names[1], "-") == 0)))
     {
-        fprintf(stderr, "ERROR: not use memmory\n");
-        return 3;
+        // the commands come from stdin and the table goes to stdout
+        fprintf(stderr, "ERROR: -I takes one input and one output (not -), without a sweep, -r or -j\n");
+        return 1;
     }
-
-    unsigned char* threshold_global = (unsigned char*)malloc(components * sizeof(unsigned char));
-    if (threshold_global == NULL)
+    int piped = 0;
+    for (int k = 1; k < count; k += 2)
     {
-        fprintf(stderr, "ERROR: not use memmory\n");
-        return 3;
+        piped |= (strcmp(names[k], "-") == 0);
     }
-
-    if (info > 0)
+    if (piped && (sweep || ((stats != NULL) && (strcmp(stats, "-") == 0))))
+    {
+        // the table of a sweep and the stats would be mixed into the images on stdout
+        fprintf(stderr, "ERROR: the output - (stdout) can't be used with a sweep or -j -\n");
+        return 1;
+    }
+    FILE* json = NULL;
+    if (stats != NULL)
     {
-        fprintf(stderr, "INFO: image %s\n", argv[optind]);
-        fprintf(stderr, "INFO: width %d\n", width);
-        fprintf(stderr, "INFO: height %d\n", height);
-        fprintf(stderr, "INFO: components %d\n", components);
-        fprintf(stderr, "INFO: sigma %f\n", sigma);
-        fprintf(stderr, "INFO: coeff. %f\n", coef);
-        fprintf(stderr, "INFO: delta %f\n", delta);
-        fprintf(stderr, "INFO: bound lower %d\n", bound_lower);
-        fprintf(stderr, "INFO: bound upper %d\n", bound_upper);
+        json = (strcmp(stats, "-") == 0) ? stdout : fopen(stats, "w");
+        if (json == NULL)
+        {
+            fprintf(stderr, "Failed to save %s.\n", stats);
+            return 4;
+        }
     }
-    iir_gauss_blur(width, height, components, blur, sigma);
-    image_threshold_gradsnip(width, height, components, coef, delta, bound_lower, bound_upper, info, image, blur, threshold_global);
 
-    if ( stbi_write_png(argv[optind+1], width, height, components, image, 0) == 0 )
+    int error = 0;
+    if (interactive)
     {
-        fprintf(stderr, "Failed to save %s.\n", argv[optind+1]);
-        return 4;
+        error = gradsnip_interactive(names[0], names[1], sigma, threads, coef, delta, bound_lower, bound_upper, info, packed, fixed, luma, pyramid);
+    }
+    else if (sweep)
+    {
+        error = gradsnip_sweep(names, count / 2, params, threads, info, packed, fixed, luma, pyramid, json);
+    }
+    else if (strip >= 0)
+    {
+        for (int k = 0; k < count; k += 2)
+        {
+            gradsnip_stats page;
+            gradsnip_stats_init(&page, names[k], names[k + 1], "strips", sigma, coef, delta, bound_lower, bound_upper, threads, 0, luma);
+            int retval = gradsnip_strips(names[k], names[k + 1], strip, sigma, threads, coef, delta, bound_lower, bound_upper, info, packed, luma, &page);
+            page.error = retval;
+            gradsnip_stats_write(json, &page);
+            error = (retval > error) ? retval : error;
+        }
+    }
+    else
+    {
+        error = gradsnip_batch_run(names, count / 2, sigma, threads, coef, delta, bound_lower, bound_upper, info, packed, fixed, luma, pyramid, json);
     }
 
-    return 0;
+    if ((json != NULL) && (json != stdout) && (fclose(json) != 0))
+    {
+        fprintf(stderr, "Failed to save %s.\n", stats);
+        error = (error > 4) ? error : 4;
+    }
+    if (names != argv + optind)
+    {
+        gradsnip_batch_free(names, count);
+    }
+    return error;
 }
@@ -26,7 +26,9 @@ DOCUMENTATION
 This is a single header file library. You'll have to define IIR_GAUSS_BLUR_IMPLEMENTATION before including this file to
 get the implementation. Otherwise just the header will be included.
 
-The library only has a single function: iir_gauss_blur(width, height, components, image, sigma).
+The library has two ways to blur: iir_gauss_blur(width, height, components, image, sigma) and a context
+(iir_gauss_blur_context_init(ctx, sigma, threads, pyramid), then iir_gauss_blur_context_run() for every image, see
+CONTEXT below).
 
 - `width` and `height` are the dimensions of the image in pixels.
 - `components` is the number of bytes per pixel. 1 for a grayscale image, 3 for RGB and 4 for RGBA.
@@ -39,8 +41,27 @@ The library only has a single function: iir_gauss_blur(width, height, components
   There are more informed ways to choose this parameter, see CHOOSING SIGMA below.
 
 The function mallocs an internal float buffer with the same dimensions as the image. If that turns out to be a
-bottleneck fell free to move that out of the function. The source code is quite short and straight forward (even if the
-math isn't).
+bottleneck use a context instead: iir_gauss_blur_context_run() reads the byte `image` and leaves the blurred result
+unquantized in the caller supplied `buffer` (`width * height * components` floats). The vertical passes run over blocks
+of IIR_GAUSS_BLUR_BLOCK adjacent columns; in the last (vertical backward) pass each block is finished from the bottom up
+and every finished piece of a row (the pixels `x0` to `x1 - 1` of row `y`, `row` points to the start of the row) is
+passed to `row_func(user, y, x0, x1, row)` right after it is done (if `row_func` is not NULL), so statistics over the
+blurred image can be gathered without another pass over the memory.
+
+A context splits the scanlines (horizontal passes) and then the column blocks (vertical passes) across up to `threads`
+POSIX threads (1 or less: the calling thread only, define IIR_GAUSS_BLUR_NO_THREADS to build without pthreads).
+Every scanline and column is filtered the same way whichever thread gets it, so the result is the same for any
+number of threads. With more than one thread `row_func` is called from several threads at once, but all pieces of the
+same column block come from the same thread (bottom up). The threads are the calling thread and `threads - 1` workers
+that iir_gauss_blur_context_init() starts and iir_gauss_blur_context_free() stops; in between they wait for the passes,
+so a run starts no threads.
+
+The filter kernels use AVX or SSE2 vectors when the compiler targets them (e.g. `-mavx`) and plain floats otherwise or
+when IIR_GAUSS_BLUR_NO_SIMD is defined. The vertical passes load pieces of scanlines as vectors, the horizontal passes
+filter several scanlines side by side, one per vector lane: they read tiles of the scanlines as vectors and transpose
+them, with kernels specialized for 1 to 4 components that keep the state of the recursion in registers. All variants
+give the same result.
+The source code is quite short and straight forward (even if the math isn't).
 
 The function is an implementation of the paper "Recursive implementation of the Gaussian filter" by Ian T. Young and
 Lucas J. van Vliet. It has nothing to do with recursive function calls, instead it's a special way to construct a
@@ -51,6 +72,84 @@ Instead The algorithm in the paper gets it done in just a few passes: A horizont
 vertical forward and backward pass. The work done is independent of the blur radius and so you can have ridiculously
 large blur radii without any performance impact.
 
+STRIPS
+
+iir_gauss_blur_strips(width, height, components, sigma, strip, threads, read_func, strip_func, user) blurs an image that
+is never completely in memory. It asks `read_func(user, y, count, rows)` for the next `count` rows starting at row `y`
+(return 0 to abort) and hands every blurred row to `strip_func(user, y, image, row)` from top to bottom, together with
+its byte row (which strip_func may overwrite). The rows are filtered in strips of `strip` rows (0: a default that depends
+on sigma). The horizontal passes and the vertical forward pass are exact, the vertical backward pass of each strip starts
+at a margin below it that is just large enough to let wrong start values settle below IIR_GAUSS_BLUR_STRIP_TOLERANCE
+(0.001 gray levels by default). On top of that the result differs from the blur of the whole image by the rounding noise
+of the float recursion itself, which grows with sigma: a few thousandths of a gray level for a sigma of 10, a few
+hundredths for a sigma of 30. Only `2 * strip + 2 * margin` float rows and `strip + margin` byte rows are kept in
+memory. The margin grows with sigma (about 15 rows per unit of sigma). Returns 0 if the buffers can't be allocated or
+read_func failed.
+
+FIXED POINT
+
+A context run with a `fixed` buffer (not NULL, `buffer` is not used then) keeps the blur in `width * height *
+components` 16 bit fixed point values, half the memory (and memory traffic) of the float buffer. A value `v` is stored
+as `(v + IIR_GAUSS_BLUR_FIXED_OFFSET) * IIR_GAUSS_BLUR_FIXED_SCALE` rounded to the nearest integer (by default
+`(v + 64) * 128`, steps of 1/128 from -64 to 448, enough room for the small over- and undershoot of the filter),
+IIR_GAUSS_BLUR_FROM_FIXED(q) turns it back into a float. The recursion itself still runs on floats, only the results
+handed from one pass to the next are rounded, so the result differs from the float blur by at most
+iir_gauss_blur_fixed_deviation(sigma) (about 2 / IIR_GAUSS_BLUR_FIXED_SCALE) on top of the float rounding noise.
+`row_func` gets the rounded values as floats. The horizontal passes need IIR_GAUSS_BLUR_LANES float rows per thread,
+the vertical passes 5, in the scratch of the context.
+
+LUMA
+
+A context run with `luma` > 0 blurs the luma (Y) of the image: the buffer has a single component (`width * height`
+values) and `luma` is the number of components of `image` (R, G and B first). The horizontal forward pass reads the luma
+of every pixel with iir_gauss_blur_luma() while it reads the image, no gray image is made. The luma uses the same
+integer weights as the gray conversion of stb_image, so the result is exactly the blur of the gray image stb_image
+would load (images with less than 3 components: the first component).
+
+PYRAMID
+
+A context initialized with `pyramid` not 0 gives the same kind of blur for a fraction of the work when sigma is large:
+the image is box downsampled by iir_gauss_blur_pyramid_factor(sigma) (the largest power of two that leaves a sigma of
+at least IIR_GAUSS_BLUR_PYRAMID_SIGMA at the small size, at most IIR_GAUSS_BLUR_PYRAMID_MAX), the four passes run on the
+small image with a smaller sigma (chosen so the variance of the whole chain matches the blur of the full size) and the
+result is upsampled bilinearly into the buffer (float or fixed point), row by row: every finished piece of a row goes
+to row_func as in the last vertical pass of the full size blur. With a factor of 1 it is the full size blur.
+
+iir_gauss_blur_pyramid_deviation(sigma) is the difference to the full size blur at a straight edge from 0 to 255, what
+text and line art see: 0.7 gray levels at a sigma of 10 (factor 2), 1.1 at 20, 1.7 at 40 and 5.3 at 80 (factor 16); the
+differences measured on pages of text are about half of it. It holds away from the borders: within about 3 sigma of
+them the recursions start from the edge values at different sizes and the blurs can differ by a few gray levels.
+
+The trade-off: a threshold on the pyramid blur flips the samples that sit within that difference of their threshold.
+On a color test page of 1100x900 pixels 0.01 to 0.1 % of the samples away from the borders flip at a sigma of 20 to 80,
+but 0.3 to 1 % of those within 3 sigma of the borders, so on a small image with a large sigma (where that band is most
+of the image) up to about 1 % flip. The blur of a small image is cheap at full size anyway; the pyramid pays off on large
+pages.
+
+CONTEXT
+
+    iir_gauss_blur_context ctx;
+    iir_gauss_blur_context_init(&ctx, sigma, threads, 0);
+    // for every frame: blur the G of an RGBA frame with rows of `stride` bytes
+    iir_gauss_blur_context_run(&ctx, width, height, 1, 0, frame + 1, stride, 4, buffer, NULL, row_func, user);
+    ...
+    iir_gauss_blur_context_free(&ctx);
+
+A context keeps the coefficients of one sigma (and, with `pyramid` not 0, the factor and the coefficients at the small
+size, whose search is the costly part) and the scratch buffers of the fixed point and the pyramid blur. The scratch
+only grows: once it fits the largest image, iir_gauss_blur_context_run() does not allocate anything. The run blurs
+into `buffer` (or `fixed` if it is not NULL), the float, fixed point, luma and pyramid blurs above are its settings.
+The image does not have to be packed: its rows are `stride` bytes apart (0: `width * step`) and its pixels `step` bytes
+(0: `components`), the `components` blurred channels start at `image`, so a channel is picked by offsetting `image`.
+With `luma` > 0 the luma of the first `luma` channels is blurred into a single component (`step` 0: `luma`). Returns 0
+if the scratch can't grow. A context is used by one run at a time; iir_gauss_blur() is a thin wrapper with a context of
+its own.
+
+iir_gauss_blur_context_dispatch(ctx, func, items, item_size, count) runs `func` on `count` items of `item_size` bytes
+(`items` is an array of them) on the workers of the context, the first item on the calling thread and the items beyond
+the workers as well, and returns when all are done. Other passes over an image can share the workers of a context this
+way (thresgradsnip.h runs its steps on them), but not while a run of the context is going on.
+
 CHOOSING SIGMA
 
 There seem to be several rules of thumb out there to get a sigma for a given "blur radius". Usually this is something
@@ -80,42 +179,198 @@ let me know. :)
 VERSION HISTORY
 
 v1.0  2018-08-30  Initial release
+v1.1  2026-10-16  Float output with row callback (iir_gauss_blur_float), vertical passes walk whole scanlines
+v1.2  2026-10-16  Column blocks in the vertical passes, SSE2/AVX kernels
+v1.3  2026-10-16  Threads
+v1.4  2026-10-16  Strips (iir_gauss_blur_strips)
+v1.5  2026-10-16  16 bit fixed point buffer (iir_gauss_blur_fixed)
+v1.6  2026-10-16  Blur of the luma (iir_gauss_blur_float_luma, iir_gauss_blur_fixed_luma)
+v1.7  2026-10-16  Pyramid blur for large sigmas (iir_gauss_blur_pyramid)
+v1.8  2026-10-17  Reusable context with row stride and pixel step (iir_gauss_blur_context)
+v1.9  2026-10-17  Horizontal kernels on transposed tiles for 1 to 4 components
+v1.10 2026-10-17  Float, fixed point, luma and pyramid blurs only through the context
+v1.11 2026-10-17  Workers of the context started once (iir_gauss_blur_context_dispatch)
+v1.12 2026-10-17  iir_gauss_blur_pyramid_deviation gives the difference at an edge, not a loose bound
 
 **/
 #ifndef IIR_GAUSS_BLUR_HEADER
 #define IIR_GAUSS_BLUR_HEADER
+#include <stddef.h>
 #ifdef __cplusplus
     extern "C" {
 #endif
 
+// Width in pixels of the column blocks of the vertical passes (and of the row pieces given to a row_func)
+#ifndef IIR_GAUSS_BLUR_BLOCK
+#define IIR_GAUSS_BLUR_BLOCK 256
+#endif
+// Upper limit of the number of threads of a context
+#ifndef IIR_GAUSS_BLUR_THREADS_MAX
+#define IIR_GAUSS_BLUR_THREADS_MAX 256
+#endif
+
+// Largest difference of the blur of iir_gauss_blur_strips() to the blur of the whole image (in gray levels)
+#ifndef IIR_GAUSS_BLUR_STRIP_TOLERANCE
+#define IIR_GAUSS_BLUR_STRIP_TOLERANCE 0.001f
+#endif
+
+// Fixed point buffer of a context run: q = (v + IIR_GAUSS_BLUR_FIXED_OFFSET) * IIR_GAUSS_BLUR_FIXED_SCALE
+#ifndef IIR_GAUSS_BLUR_FIXED_SCALE
+#define IIR_GAUSS_BLUR_FIXED_SCALE 128
+#endif
+#ifndef IIR_GAUSS_BLUR_FIXED_OFFSET
+#define IIR_GAUSS_BLUR_FIXED_OFFSET 64
+#endif
+// Pyramid blur: the smallest sigma left at the small size, the largest downsampling factor
+#ifndef IIR_GAUSS_BLUR_PYRAMID_SIGMA
+#define IIR_GAUSS_BLUR_PYRAMID_SIGMA 4.0f
+#endif
+#ifndef IIR_GAUSS_BLUR_PYRAMID_MAX
+#define IIR_GAUSS_BLUR_PYRAMID_MAX 64
+#endif
+#define IIR_GAUSS_BLUR_FROM_FIXED(q) ((float)(q) * (1.0f / IIR_GAUSS_BLUR_FIXED_SCALE) - IIR_GAUSS_BLUR_FIXED_OFFSET)
+
+// Luma (Y) of a pixel with `components` components: (77 R + 150 G + 29 B) / 256 like stb_image, or the first component
+static inline unsigned char iir_gauss_blur_luma(const unsigned char* pixel, unsigned char components) {
+    return (components < 3) ? pixel[0] : (unsigned char)((pixel[0] * 77 + pixel[1] * 150 + pixel[2] * 29) >> 8);
+}
+
+typedef void (*iir_gauss_blur_row_func)(void* user, unsigned int y, unsigned int x0, unsigned int x1, const float* row);
+typedef int (*iir_gauss_blur_read_func)(void* user, unsigned int y, unsigned int count, unsigned char* rows);
+typedef void (*iir_gauss_blur_strip_func)(void* user, unsigned int y, unsigned char* image, const float* row);
+
+// Coefficients of one sigma and scratch buffers that are kept from run to run (see CONTEXT above)
+typedef struct {
+    float sigma;
+    int threads;
+    int blur;               // 0: sigma is too small, the image is copied
+    float c[5];             // the coefficients of the full size
+    unsigned int factor;    // pyramid: the downsampling factor (1: no pyramid)
+    float cs[5];            // pyramid: the coefficients of the small size
+    void* scratch;
+    size_t scratch_size;
+    void* pool;             // the workers of the context (NULL: every pass runs on the calling thread)
+} iir_gauss_blur_context;
+
 void iir_gauss_blur(unsigned int width, unsigned int height, unsigned char components, unsigned char* image, float sigma);
+int iir_gauss_blur_strips(unsigned int width, unsigned int height, unsigned char components, float sigma, unsigned int strip, int threads, iir_gauss_blur_read_func read_func, iir_gauss_blur_strip_func strip_func, void* user);
+float iir_gauss_blur_fixed_deviation(float sigma);
+unsigned int iir_gauss_blur_pyramid_factor(float sigma);
+float iir_gauss_blur_pyramid_deviation(float sigma);
+void iir_gauss_blur_context_init(iir_gauss_blur_context* ctx, float sigma, int threads, int pyramid);
+void iir_gauss_blur_context_free(iir_gauss_blur_context* ctx);
+void iir_gauss_blur_context_dispatch(iir_gauss_blur_context* ctx, void* (*func)(void*), void* items, size_t item_size, unsigned int count);
+int iir_gauss_blur_context_run(iir_gauss_blur_context* ctx, unsigned int width, unsigned int height, unsigned char components, unsigned char luma, const unsigned char* image, size_t stride, unsigned char step, float* buffer, unsigned short* fixed, iir_gauss_blur_row_func row_func, void* user);
 
 #ifdef __cplusplus
     }
 #endif
 #endif  // IIR_GAUSS_BLUR_HEADER
 
-#ifdef IIR_GAUSS_BLUR_IMPLEMENTATION
+#if defined(IIR_GAUSS_BLUR_IMPLEMENTATION) && !defined(IIR_GAUSS_BLUR_IMPLEMENTED)
+#define IIR_GAUSS_BLUR_IMPLEMENTED
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#ifndef IIR_GAUSS_BLUR_NO_THREADS
+#include <pthread.h>
+#endif
 
-void iir_gauss_blur(unsigned int width, unsigned int height, unsigned char components, unsigned char* image, float sigma) {
-    // Create IDX macro but push any previous definition (and restore it later) so we don't overwrite a macro the user has possibly defined before us
-    #pragma push_macro("IDX")
-    #define IDX(x, y, n) ((y)*width*components + (x)*components + n)
-    
-    // Allocate buffers
-    float* buffer = (float*)malloc(width * height * components * sizeof(buffer[0]));
-    
-    // Calculate filter parameters for a specified sigma
-    // Use Equation 11b to determine q, do nothing if sigma is to small (should have no effect) or negative (doesn't make sense)
+// Vector type of the filter kernels, picked at build time (define IIR_GAUSS_BLUR_NO_SIMD to get the scalar code).
+// The vector code does exactly the same float operations per sample as the scalar code, so the results are the same.
+#if defined(__AVX__) && !defined(IIR_GAUSS_BLUR_NO_SIMD)
+#include <immintrin.h>
+#define IIR_GAUSS_BLUR_LANES 8
+typedef __m256 iir_gauss_blur_vec;
+#define IIR_GAUSS_BLUR_VEC_SET1(a) _mm256_set1_ps(a)
+#define IIR_GAUSS_BLUR_VEC_LOAD(p) _mm256_loadu_ps(p)
+#define IIR_GAUSS_BLUR_VEC_STORE(p, a) _mm256_storeu_ps(p, a)
+#define IIR_GAUSS_BLUR_VEC_ADD(a, b) _mm256_add_ps(a, b)
+#define IIR_GAUSS_BLUR_VEC_MUL(a, b) _mm256_mul_ps(a, b)
+#define IIR_GAUSS_BLUR_VEC_DIV(a, b) _mm256_div_ps(a, b)
+// Transpose 8 vectors: t[l][k] becomes t[k][l]
+static inline void iir_gauss_blur_vec_transpose(__m256* t) {
+    __m256 u0 = _mm256_unpacklo_ps(t[0], t[1]), u1 = _mm256_unpackhi_ps(t[0], t[1]);
+    __m256 u2 = _mm256_unpacklo_ps(t[2], t[3]), u3 = _mm256_unpackhi_ps(t[2], t[3]);
+    __m256 u4 = _mm256_unpacklo_ps(t[4], t[5]), u5 = _mm256_unpackhi_ps(t[4], t[5]);
+    __m256 u6 = _mm256_unpacklo_ps(t[6], t[7]), u7 = _mm256_unpackhi_ps(t[6], t[7]);
+    __m256 s0 = _mm256_shuffle_ps(u0, u2, _MM_SHUFFLE(1, 0, 1, 0)), s1 = _mm256_shuffle_ps(u0, u2, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s2 = _mm256_shuffle_ps(u1, u3, _MM_SHUFFLE(1, 0, 1, 0)), s3 = _mm256_shuffle_ps(u1, u3, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s4 = _mm256_shuffle_ps(u4, u6, _MM_SHUFFLE(1, 0, 1, 0)), s5 = _mm256_shuffle_ps(u4, u6, _MM_SHUFFLE(3, 2, 3, 2));
+    __m256 s6 = _mm256_shuffle_ps(u5, u7, _MM_SHUFFLE(1, 0, 1, 0)), s7 = _mm256_shuffle_ps(u5, u7, _MM_SHUFFLE(3, 2, 3, 2));
+    t[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+    t[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+    t[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+    t[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+    t[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+    t[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+    t[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+    t[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+#define IIR_GAUSS_BLUR_VEC_TRANSPOSE(t) iir_gauss_blur_vec_transpose(t)
+#elif defined(__SSE2__) && !defined(IIR_GAUSS_BLUR_NO_SIMD)
+#include <emmintrin.h>
+#define IIR_GAUSS_BLUR_LANES 4
+typedef __m128 iir_gauss_blur_vec;
+#define IIR_GAUSS_BLUR_VEC_SET1(a) _mm_set1_ps(a)
+#define IIR_GAUSS_BLUR_VEC_LOAD(p) _mm_loadu_ps(p)
+#define IIR_GAUSS_BLUR_VEC_STORE(p, a) _mm_storeu_ps(p, a)
+#define IIR_GAUSS_BLUR_VEC_ADD(a, b) _mm_add_ps(a, b)
+#define IIR_GAUSS_BLUR_VEC_MUL(a, b) _mm_mul_ps(a, b)
+#define IIR_GAUSS_BLUR_VEC_DIV(a, b) _mm_div_ps(a, b)
+#define IIR_GAUSS_BLUR_VEC_TRANSPOSE(t) _MM_TRANSPOSE4_PS(t[0], t[1], t[2], t[3])
+#else
+#define IIR_GAUSS_BLUR_LANES 1
+typedef float iir_gauss_blur_vec;
+#define IIR_GAUSS_BLUR_VEC_SET1(a) (a)
+#define IIR_GAUSS_BLUR_VEC_LOAD(p) (*(p))
+#define IIR_GAUSS_BLUR_VEC_STORE(p, a) (*(p) = (a))
+#define IIR_GAUSS_BLUR_VEC_ADD(a, b) ((a) + (b))
+#define IIR_GAUSS_BLUR_VEC_MUL(a, b) ((a) * (b))
+#define IIR_GAUSS_BLUR_VEC_DIV(a, b) ((a) / (b))
+#define IIR_GAUSS_BLUR_VEC_TRANSPOSE(t)
+#endif
+// Kernels specialized by inlining them with constant arguments (the number of components, the direction): the loops
+// over the components unroll and the state of the recursion stays in registers
+#if defined(__GNUC__)
+#define IIR_GAUSS_BLUR_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define IIR_GAUSS_BLUR_INLINE static __forceinline
+#else
+#define IIR_GAUSS_BLUR_INLINE static inline
+#endif
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 8)
+#define IIR_GAUSS_BLUR_PRAGMA(x) _Pragma(#x)
+#define IIR_GAUSS_BLUR_UNROLL(n) IIR_GAUSS_BLUR_PRAGMA(GCC unroll n)
+#else
+#define IIR_GAUSS_BLUR_UNROLL(n)
+#endif
+// One step of the recursion: B * x + (b1 * prev1 + b2 * prev2 + b3 * prev3) / b0, in exactly this order in every kernel
+// (a multiplication by 1 / b0 would round differently and flip samples that sit right at their threshold)
+#define IIR_GAUSS_BLUR_KERNEL_COEFFICIENTS(c) \
+    const float* a = (c); \
+    iir_gauss_blur_vec B = IIR_GAUSS_BLUR_VEC_SET1(a[0]), b0 = IIR_GAUSS_BLUR_VEC_SET1(a[1]); \
+    iir_gauss_blur_vec b1 = IIR_GAUSS_BLUR_VEC_SET1(a[2]), b2 = IIR_GAUSS_BLUR_VEC_SET1(a[3]), b3 = IIR_GAUSS_BLUR_VEC_SET1(a[4])
+#define IIR_GAUSS_BLUR_STEP(x, p1, p2, p3) (a[0] * (x) + (a[2] * (p1) + a[3] * (p2) + a[4] * (p3)) / a[1])
+#define IIR_GAUSS_BLUR_VEC_STEP(x, p1, p2, p3) IIR_GAUSS_BLUR_VEC_ADD(IIR_GAUSS_BLUR_VEC_MUL(B, x), IIR_GAUSS_BLUR_VEC_DIV( \
+    IIR_GAUSS_BLUR_VEC_ADD(IIR_GAUSS_BLUR_VEC_ADD(IIR_GAUSS_BLUR_VEC_MUL(b1, p1), IIR_GAUSS_BLUR_VEC_MUL(b2, p2)), IIR_GAUSS_BLUR_VEC_MUL(b3, p3)), b0))
+
+static inline unsigned short iir_gauss_blur_to_fixed(float v) {
+    float q = (v + IIR_GAUSS_BLUR_FIXED_OFFSET) * IIR_GAUSS_BLUR_FIXED_SCALE + 0.5f;
+    return (q > 0.0f) ? ((q < 65535.0f) ? (unsigned short)q : 65535) : 0;
+}
+
+// Calculate filter parameters for a specified sigma: c = { B, b0, b1, b2, b3 }
+// Returns 0 if sigma is to small (should have no effect) or negative (doesn't make sense)
+static int iir_gauss_blur_coefficients(float sigma, float* c) {
+    // Use Equation 11b to determine q
     float q;
     if (sigma >= 2.5)
         q = 0.98711 * sigma - 0.96330;
     else if (sigma >= 0.5)
         q = 3.97156 - 4.14554 * sqrtf(1.0 - 0.26891 * sigma);
     else
-        return;
+        return 0;
     
     // Use equation 8c to determine b0, b1, b2 and b3
     float b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
@@ -125,90 +380,978 @@ void iir_gauss_blur(unsigned int width, unsigned int height, unsigned char compo
     // Use equation 10 to determine B
     float B = 1.0 - (b1 + b2 + b3) / b0;
     
-    // Horizontal forward pass (from paper: Implement the forward filter with equation 9a)
-    // The data is loaded from the byte image but stored in the float buffer
-    for(unsigned int y = 0; y < height; y++) {
-        float prev1[components], prev2[components], prev3[components];
-        for(unsigned char n = 0; n < components; n++) {
-            prev1[n] = image[IDX(0, y, n)];
-            prev2[n] = prev1[n];
-            prev3[n] = prev2[n];
+    c[0] = B; c[1] = b0; c[2] = b1; c[3] = b2; c[4] = b3;
+    return 1;
+}
+
+// Vertical pass over blocks of IIR_GAUSS_BLUR_BLOCK adjacent columns: the previous values of the recursion are just
+// the previous (already filtered) rows, so each block walks down the image one short contiguous piece of a scanline at a
+// time (loaded as whole vectors) instead of one column at a time with a stride of a full scanline.
+// The first three rows of a block still start from the edge value of their column, unless the pass continues after
+// `first` rows that are already filtered (first >= 3).
+// Only the blocks of the columns `xb` to `xe - 1` are filtered (`xb` is a multiple of IIR_GAUSS_BLUR_BLOCK).
+static void iir_gauss_blur_vertical(unsigned int width, unsigned int height, unsigned char components, float* buffer, const float* c, int backward, unsigned int first, unsigned int xb, unsigned int xe, iir_gauss_blur_row_func row_func, void* user) {
+    #pragma push_macro("ROW")
+    #define ROW(k) (buffer + (size_t)(backward ? (height - 1 - (k)) : (k)) * rowlen)
+    IIR_GAUSS_BLUR_KERNEL_COEFFICIENTS(c);
+    size_t rowlen = (size_t)width * components;
+    unsigned int head = (first > 0) ? 0 : ((height < 3) ? height : 3);
+    
+    for(unsigned int x0 = xb; x0 < xe; x0 += IIR_GAUSS_BLUR_BLOCK) {
+        unsigned int x1 = (xe - x0 > IIR_GAUSS_BLUR_BLOCK) ? x0 + IIR_GAUSS_BLUR_BLOCK : xe;
+        size_t i0 = (size_t)x0 * components, i1 = (size_t)x1 * components;
+        // Whole vectors first, the remaining floats of the block are done with the scalar code below
+        size_t iv = i0 + (i1 - i0) / IIR_GAUSS_BLUR_LANES * IIR_GAUSS_BLUR_LANES;
+        
+        for(size_t i = i0; i < iv; i += IIR_GAUSS_BLUR_LANES) {
+            iir_gauss_blur_vec prev1 = IIR_GAUSS_BLUR_VEC_LOAD(ROW(0) + i), prev2 = prev1, prev3 = prev2;
+            for(unsigned int k = 0; k < head; k++) {
+                iir_gauss_blur_vec val = IIR_GAUSS_BLUR_VEC_STEP(IIR_GAUSS_BLUR_VEC_LOAD(ROW(k) + i), prev1, prev2, prev3);
+                IIR_GAUSS_BLUR_VEC_STORE(ROW(k) + i, val);
+                prev3 = prev2;
+                prev2 = prev1;
+                prev1 = val;
+            }
+        }
+        for(size_t i = iv; i < i1; i++) {
+            float prev1 = ROW(0)[i], prev2 = prev1, prev3 = prev2;
+            for(unsigned int k = 0; k < head; k++) {
+                float val = IIR_GAUSS_BLUR_STEP(ROW(k)[i], prev1, prev2, prev3);
+                ROW(k)[i] = val;
+                prev3 = prev2;
+                prev2 = prev1;
+                prev1 = val;
+            }
+        }
+        if (row_func != NULL) {
+            for(unsigned int k = 0; k < head; k++)
+                row_func(user, backward ? (height - 1 - k) : k, x0, x1, ROW(k));
         }
         
-        for(unsigned int x = 0; x < width; x++) {
-            for(unsigned char n = 0; n < components; n++) {
-                float val = B * image[IDX(x, y, n)] + (b1 * prev1[n] + b2 * prev2[n] + b3 * prev3[n]) / b0;
-                buffer[IDX(x, y, n)] = val;
-                prev3[n] = prev2[n];
-                prev2[n] = prev1[n];
-                prev1[n] = val;
+        for(unsigned int k = (first > 0) ? first : head; k < height; k++) {
+            float* row = ROW(k);
+            const float* prev1 = ROW(k - 1);
+            const float* prev2 = ROW(k - 2);
+            const float* prev3 = ROW(k - 3);
+            for(size_t i = i0; i < iv; i += IIR_GAUSS_BLUR_LANES) {
+                iir_gauss_blur_vec val = IIR_GAUSS_BLUR_VEC_STEP(IIR_GAUSS_BLUR_VEC_LOAD(row + i),
+                    IIR_GAUSS_BLUR_VEC_LOAD(prev1 + i), IIR_GAUSS_BLUR_VEC_LOAD(prev2 + i), IIR_GAUSS_BLUR_VEC_LOAD(prev3 + i));
+                IIR_GAUSS_BLUR_VEC_STORE(row + i, val);
             }
+            for(size_t i = iv; i < i1; i++)
+                row[i] = IIR_GAUSS_BLUR_STEP(row[i], prev1[i], prev2[i], prev3[i]);
+            if (row_func != NULL)
+                row_func(user, backward ? (height - 1 - k) : k, x0, x1, row);
         }
     }
+    #pragma pop_macro("ROW")
+}
+
+// Vertical pass over the fixed point buffer, column block by column block like iir_gauss_blur_vertical(). The recursion
+// runs on floats: the last rows of the block are kept unrounded in `hist` (4 rows of `width * components` floats, used as
+// a ring), each row is read from and rounded back into the buffer. The rounded values of a finished piece are passed to
+// row_func in `out` (one row of floats).
+static void iir_gauss_blur_vertical_fixed(unsigned int width, unsigned int height, unsigned char components, unsigned short* fixed, const float* c, int backward, unsigned int xb, unsigned int xe, float* hist, float* out, iir_gauss_blur_row_func row_func, void* user) {
+    IIR_GAUSS_BLUR_KERNEL_COEFFICIENTS(c);
+    size_t rowlen = (size_t)width * components;
     
-    // Horizontal backward pass (from paper: Implement the backward filter with equation 9b)
-    for(unsigned int y = height-1; y < height; y--) {
-        float prev1[components], prev2[components], prev3[components];
-        for(unsigned char n = 0; n < components; n++) {
-            prev1[n] = buffer[IDX(width-1, y, n)];
-            prev2[n] = prev1[n];
-            prev3[n] = prev2[n];
-        }
+    for(unsigned int x0 = xb; x0 < xe; x0 += IIR_GAUSS_BLUR_BLOCK) {
+        unsigned int x1 = (xe - x0 > IIR_GAUSS_BLUR_BLOCK) ? x0 + IIR_GAUSS_BLUR_BLOCK : xe;
+        size_t i0 = (size_t)x0 * components, i1 = (size_t)x1 * components;
+        size_t iv = i0 + (i1 - i0) / IIR_GAUSS_BLUR_LANES * IIR_GAUSS_BLUR_LANES;
         
-        for(unsigned int x = width-1; x < width; x--) {
-            for(unsigned char n = 0; n < components; n++) {
-                float val = B * buffer[IDX(x, y, n)] + (b1 * prev1[n] + b2 * prev2[n] + b3 * prev3[n]) / b0;
-                buffer[IDX(x, y, n)] = val;
+        for(unsigned int k = 0; k < height; k++) {
+            unsigned int y = backward ? height - 1 - k : k;
+            unsigned short* q = fixed + (size_t)y * rowlen;
+            float* row = hist + (size_t)(k & 3) * rowlen;
+            const float* prev1 = hist + (size_t)((k + 3) & 3) * rowlen;
+            const float* prev2 = hist + (size_t)((k + 2) & 3) * rowlen;
+            const float* prev3 = hist + (size_t)((k + 1) & 3) * rowlen;
+            for(size_t i = i0; i < i1; i++)
+                row[i] = IIR_GAUSS_BLUR_FROM_FIXED(q[i]);
+            // The first row starts from the edge value of its column
+            if (k == 0) {
+                for(unsigned int j = 1; j < 4; j++)
+                    memcpy(hist + j * rowlen + i0, row + i0, (i1 - i0) * sizeof(float));
+            }
+            for(size_t i = i0; i < iv; i += IIR_GAUSS_BLUR_LANES) {
+                iir_gauss_blur_vec val = IIR_GAUSS_BLUR_VEC_STEP(IIR_GAUSS_BLUR_VEC_LOAD(row + i),
+                    IIR_GAUSS_BLUR_VEC_LOAD(prev1 + i), IIR_GAUSS_BLUR_VEC_LOAD(prev2 + i), IIR_GAUSS_BLUR_VEC_LOAD(prev3 + i));
+                IIR_GAUSS_BLUR_VEC_STORE(row + i, val);
+            }
+            for(size_t i = iv; i < i1; i++)
+                row[i] = IIR_GAUSS_BLUR_STEP(row[i], prev1[i], prev2[i], prev3[i]);
+            for(size_t i = i0; i < i1; i++)
+                q[i] = iir_gauss_blur_to_fixed(row[i]);
+            if (row_func != NULL) {
+                for(size_t i = i0; i < i1; i++)
+                    out[i] = IIR_GAUSS_BLUR_FROM_FIXED(q[i]);
+                row_func(user, y, x0, x1, out);
+            }
+        }
+    }
+}
+
+// One horizontal pass over IIR_GAUSS_BLUR_LANES scanlines of floats at once (`lines`, `width` pixels of `components`
+// components each), one scanline per vector lane. The recursion of a single scanline is a long dependency chain,
+// filtering several of them side by side keeps the vector units busy. The scanlines are read and written in tiles of
+// IIR_GAUSS_BLUR_LANES floats from each of them, transposed so that a vector holds the same sample of every scanline;
+// a group of `components` tiles is IIR_GAUSS_BLUR_LANES whole pixels, the pixels left over are gathered one by one.
+IIR_GAUSS_BLUR_INLINE void iir_gauss_blur_scanlines(float** lines, unsigned int width, unsigned char components, const float* c, int backward) {
+    IIR_GAUSS_BLUR_KERNEL_COEFFICIENTS(c);
+    size_t rowlen = (size_t)width * components, group = (size_t)IIR_GAUSS_BLUR_LANES * components;
+    size_t groups = rowlen / group;
+    float lane[IIR_GAUSS_BLUR_LANES];
+    iir_gauss_blur_vec prev1[components], prev2[components], prev3[components];
+    for(unsigned char n = 0; n < components; n++) {
+        size_t i = backward ? rowlen - components + n : n;
+        for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++)
+            lane[l] = lines[l][i];
+        prev1[n] = IIR_GAUSS_BLUR_VEC_LOAD(lane);
+        prev2[n] = prev1[n];
+        prev3[n] = prev2[n];
+    }
+    
+    for(size_t g = 0; g < groups; g++) {
+        size_t i0 = backward ? rowlen - (g + 1) * group : g * group;
+        // The component of the sample: known at every step once the loops are unrolled for a constant `components`
+        unsigned char n = backward ? components - 1 : 0;
+        IIR_GAUSS_BLUR_UNROLL(4)
+        for(unsigned int j = 0; j < components; j++) {
+            size_t i = i0 + (size_t)(backward ? components - 1 - j : j) * IIR_GAUSS_BLUR_LANES;
+            iir_gauss_blur_vec t[IIR_GAUSS_BLUR_LANES];
+            for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++)
+                t[l] = IIR_GAUSS_BLUR_VEC_LOAD(lines[l] + i);
+            IIR_GAUSS_BLUR_VEC_TRANSPOSE(t);
+            IIR_GAUSS_BLUR_UNROLL(8)
+            for(unsigned int k = 0; k < IIR_GAUSS_BLUR_LANES; k++) {
+                unsigned int m = backward ? IIR_GAUSS_BLUR_LANES - 1 - k : k;
+                iir_gauss_blur_vec val = IIR_GAUSS_BLUR_VEC_STEP(t[m], prev1[n], prev2[n], prev3[n]);
+                t[m] = val;
                 prev3[n] = prev2[n];
                 prev2[n] = prev1[n];
                 prev1[n] = val;
+                n = backward ? ((n > 0) ? n - 1 : components - 1) : ((n + 1 < components) ? n + 1 : 0);
             }
+            IIR_GAUSS_BLUR_VEC_TRANSPOSE(t);
+            for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++)
+                IIR_GAUSS_BLUR_VEC_STORE(lines[l] + i, t[l]);
         }
     }
     
-    // Vertical forward pass (from paper: Implement the forward filter with equation 9a)
-    for(unsigned int x = 0; x < width; x++) {
-        float prev1[components], prev2[components], prev3[components];
-        for(unsigned char n = 0; n < components; n++) {
-            prev1[n] = buffer[IDX(x, 0, n)];
-            prev2[n] = prev1[n];
+    for(size_t x = groups * IIR_GAUSS_BLUR_LANES; x < width; x++) {
+        size_t i = (backward ? width - 1 - x : x) * components;
+        for(unsigned char n = 0; n < components; n++, i++) {
+            for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++)
+                lane[l] = lines[l][i];
+            iir_gauss_blur_vec val = IIR_GAUSS_BLUR_VEC_STEP(IIR_GAUSS_BLUR_VEC_LOAD(lane), prev1[n], prev2[n], prev3[n]);
+            IIR_GAUSS_BLUR_VEC_STORE(lane, val);
+            for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++)
+                lines[l][i] = lane[l];
             prev3[n] = prev2[n];
+            prev2[n] = prev1[n];
+            prev1[n] = val;
+        }
+    }
+}
+
+// iir_gauss_blur_scanlines() specialized for gray, gray and alpha, RGB and RGBA images (the generic kernel for the rest)
+static void iir_gauss_blur_scanlines_pass(float** lines, unsigned int width, unsigned char components, const float* c, int backward) {
+    if (backward) {
+        switch (components) {
+            case 1: iir_gauss_blur_scanlines(lines, width, 1, c, 1); break;
+            case 2: iir_gauss_blur_scanlines(lines, width, 2, c, 1); break;
+            case 3: iir_gauss_blur_scanlines(lines, width, 3, c, 1); break;
+            case 4: iir_gauss_blur_scanlines(lines, width, 4, c, 1); break;
+            default: iir_gauss_blur_scanlines(lines, width, components, c, 1); break;
+        }
+    } else {
+        switch (components) {
+            case 1: iir_gauss_blur_scanlines(lines, width, 1, c, 0); break;
+            case 2: iir_gauss_blur_scanlines(lines, width, 2, c, 0); break;
+            case 3: iir_gauss_blur_scanlines(lines, width, 3, c, 0); break;
+            case 4: iir_gauss_blur_scanlines(lines, width, 4, c, 0); break;
+            default: iir_gauss_blur_scanlines(lines, width, components, c, 0); break;
+        }
+    }
+}
+
+// Both horizontal passes over the scanlines `yb` to `ye - 1`, IIR_GAUSS_BLUR_LANES of them at a time (lanes past the last
+// scanline just filter the last scanline once more). The forward pass reads the byte image (src != NULL) into the float
+// buffer first, its rows are `stride` bytes apart and its pixels `step` bytes; with `luma` > 0 it reads the luma of the
+// first `luma` components of every pixel (the buffer has a single component then). Without an image the float buffer
+// is filtered in place. With a fixed point buffer (`fixed` != NULL) the scanlines are filtered in `scratch`
+// (IIR_GAUSS_BLUR_LANES rows of floats) and the results of each pass are rounded into the fixed point buffer.
+static void iir_gauss_blur_horizontal(unsigned int width, unsigned char components, const unsigned char* src, size_t stride, unsigned char step, unsigned char luma, float* buffer, unsigned short* fixed, float* scratch, const float* c, unsigned int yb, unsigned int ye) {
+    size_t rowlen = (size_t)width * components;
+    
+    for(unsigned int y0 = yb; y0 < ye; y0 += IIR_GAUSS_BLUR_LANES) {
+        float* lines[IIR_GAUSS_BLUR_LANES];
+        unsigned short* q[IIR_GAUSS_BLUR_LANES];
+        for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++) {
+            size_t y = (y0 + l < ye) ? y0 + l : ye - 1;
+            float* line = fixed ? scratch + l * rowlen : buffer + y * rowlen;
+            q[l] = fixed ? fixed + y * rowlen : NULL;
+            lines[l] = line;
+            if (src) {
+                const unsigned char* s = src + y * stride;
+                if (luma) {
+                    for(unsigned int x = 0; x < width; x++)
+                        line[x] = iir_gauss_blur_luma(s + (size_t)x * step, luma);
+                } else if (step == components) {
+                    for(size_t i = 0; i < rowlen; i++)
+                        line[i] = s[i];
+                } else {
+                    for(unsigned int x = 0; x < width; x++)
+                        for(unsigned char n = 0; n < components; n++)
+                            line[(size_t)x * components + n] = s[(size_t)x * step + n];
+                }
+            } else if (fixed) {
+                for(size_t i = 0; i < rowlen; i++)
+                    line[i] = IIR_GAUSS_BLUR_FROM_FIXED(q[l][i]);
+            }
         }
         
+        // Forward pass (from paper: Implement the forward filter with equation 9a)
+        iir_gauss_blur_scanlines_pass(lines, width, components, c, 0);
+        if (fixed) {
+            for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++) {
+                for(size_t i = 0; i < rowlen; i++) {
+                    q[l][i] = iir_gauss_blur_to_fixed(lines[l][i]);
+                    lines[l][i] = IIR_GAUSS_BLUR_FROM_FIXED(q[l][i]);
+                }
+            }
+        }
+        // Backward pass (from paper: Implement the backward filter with equation 9b)
+        iir_gauss_blur_scanlines_pass(lines, width, components, c, 1);
+        if (fixed) {
+            for(unsigned int l = 0; l < IIR_GAUSS_BLUR_LANES; l++)
+                for(size_t i = 0; i < rowlen; i++)
+                    q[l][i] = iir_gauss_blur_to_fixed(lines[l][i]);
+        }
+    }
+}
+
+// A share of the work of a context run: the scanlines (horizontal passes) or the column blocks (vertical passes)
+// from `begin` to `end - 1`. Every scanline and every column is filtered by exactly one task with exactly the same
+// operations, so the result does not depend on the number of threads.
+typedef struct {
+    unsigned int width, height;
+    unsigned char components;
+    const unsigned char* image;
+    float* buffer;
+    const float* c;
+    unsigned int begin, end;
+    iir_gauss_blur_row_func row_func;
+    void* user;
+    int passes;             // vertical passes: 1 forward, 2 backward, 3 both
+    unsigned int first;     // rows already filtered by the vertical forward pass
+    unsigned short* fixed;  // fixed point buffer (instead of `buffer`)
+    float* scratch;         // fixed point: IIR_GAUSS_BLUR_LANES float rows (horizontal) or 5 (vertical) per task
+    unsigned int index;     // number of the task
+    unsigned char luma;     // luma blur: the components of a pixel it is made of (0: no luma blur)
+    const float* small;     // pyramid: the image at 1 / factor of its size
+    unsigned int factor;    // pyramid: the downsampling factor (0: no pyramid)
+    const unsigned int* xs; // pyramid: the left column of the small image of every column
+    const float* xw;        // pyramid: the weight of the right column of the small image of every column
+    size_t stride;          // the bytes from one row of the image to the next
+    unsigned char step;     // the bytes from one pixel of the image to the next
+} iir_gauss_blur_task;
+
+static void* iir_gauss_blur_rows_task(void* arg) {
+    iir_gauss_blur_task* t = (iir_gauss_blur_task*)arg;
+    // Both horizontal passes, the data is loaded from the byte image but stored in the float buffer
+    float* scratch = t->fixed ? t->scratch + (size_t)t->index * IIR_GAUSS_BLUR_LANES * t->width * t->components : NULL;
+    iir_gauss_blur_horizontal(t->width, t->components, t->image, t->stride, t->step, t->luma, t->buffer, t->fixed, scratch, t->c, t->begin, t->end);
+    return NULL;
+}
+
+static void* iir_gauss_blur_columns_task(void* arg) {
+    iir_gauss_blur_task* t = (iir_gauss_blur_task*)arg;
+    unsigned int xb = t->begin * IIR_GAUSS_BLUR_BLOCK;
+    unsigned int xe = (t->end < (t->width + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK) ? t->end * IIR_GAUSS_BLUR_BLOCK : t->width;
+    if (t->fixed) {
+        size_t rowlen = (size_t)t->width * t->components;
+        float* hist = t->scratch + (size_t)t->index * 5 * rowlen;
+        iir_gauss_blur_vertical_fixed(t->width, t->height, t->components, t->fixed, t->c, 0, xb, xe, hist, hist + 4 * rowlen, NULL, NULL);
+        iir_gauss_blur_vertical_fixed(t->width, t->height, t->components, t->fixed, t->c, 1, xb, xe, hist, hist + 4 * rowlen, t->row_func, t->user);
+        return NULL;
+    }
+    // Vertical forward pass (from paper: Implement the forward filter with equation 9a)
+    if (t->passes & 1)
+        iir_gauss_blur_vertical(t->width, t->height, t->components, t->buffer, t->c, 0, t->first, xb, xe, NULL, NULL);
+    // Vertical backward pass (from paper: Implement the backward filter with equation 9b)
+    // Every finished piece of a row is handed to row_func, e.g. to gather statistics while it is still in the cache
+    if (t->passes & 2)
+        iir_gauss_blur_vertical(t->width, t->height, t->components, t->buffer, t->c, 1, 0, xb, xe, t->row_func, t->user);
+    return NULL;
+}
+
+// The number of threads iir_gauss_blur_run() uses for `count` units of work
+static int iir_gauss_blur_threads(unsigned int count, unsigned int unit, int threads) {
+    unsigned int shares = (count + unit - 1) / unit;
+    if (threads > IIR_GAUSS_BLUR_THREADS_MAX)
+        threads = IIR_GAUSS_BLUR_THREADS_MAX;
+    if ((unsigned int)threads > shares)
+        threads = shares;
+    if (threads < 1)
+        threads = 1;
+    return threads;
+}
+
+// The workers of a context: `count` threads that wait for the shares of the next pass, so that a run starts no threads
+// and allocates nothing. A pass is published under the lock with a new generation, every worker runs the share of its
+// index (if there is one) and the last one to finish wakes the calling thread.
+#ifndef IIR_GAUSS_BLUR_NO_THREADS
+typedef struct iir_gauss_blur_pool iir_gauss_blur_pool;
+
+typedef struct {
+    iir_gauss_blur_pool* pool;
+    int index;              // the share of the pass this worker runs (the calling thread runs share 0)
+    pthread_t id;
+} iir_gauss_blur_worker;
+
+struct iir_gauss_blur_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned long generation;
+    int quit;
+    int pending;            // workers that still run a share of the current pass
+    void* (*func)(void*);
+    char* items;
+    size_t item_size;
+    int count;              // shares of the current pass
+    int workers;            // workers started
+    iir_gauss_blur_worker worker[];
+};
+
+static void* iir_gauss_blur_pool_main(void* arg) {
+    iir_gauss_blur_worker* w = (iir_gauss_blur_worker*)arg;
+    iir_gauss_blur_pool* pool = w->pool;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for(;;) {
+        while (pool->generation == seen && !pool->quit)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        if (w->index >= pool->count)
+            continue;
+        void* (*func)(void*) = pool->func;
+        void* item = pool->items + (size_t)w->index * pool->item_size;
+        pthread_mutex_unlock(&pool->lock);
+        func(item);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Starts up to `threads - 1` workers, NULL if there is nothing to start or no memory (the passes run on the calling
+// thread then); if a thread can't be started the pool has fewer workers
+static iir_gauss_blur_pool* iir_gauss_blur_pool_start(int threads) {
+    if (threads > IIR_GAUSS_BLUR_THREADS_MAX)
+        threads = IIR_GAUSS_BLUR_THREADS_MAX;
+    if (threads < 2)
+        return NULL;
+    iir_gauss_blur_pool* pool = (iir_gauss_blur_pool*)malloc(sizeof(iir_gauss_blur_pool) + (size_t)(threads - 1) * sizeof(iir_gauss_blur_worker));
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->generation = 0;
+    pool->quit = 0;
+    pool->pending = 0;
+    pool->count = 0;
+    pool->workers = 0;
+    for(int k = 0; k < threads - 1; k++) {
+        pool->worker[k].pool = pool;
+        pool->worker[k].index = k + 1;
+        if (pthread_create(&pool->worker[k].id, NULL, iir_gauss_blur_pool_main, &pool->worker[k]) != 0)
+            break;
+        pool->workers++;
+    }
+    return pool;
+}
+
+static void iir_gauss_blur_pool_stop(iir_gauss_blur_pool* pool) {
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for(int k = 0; k < pool->workers; k++)
+        pthread_join(pool->worker[k].id, NULL);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+#endif
+
+void iir_gauss_blur_context_dispatch(iir_gauss_blur_context* ctx, void* (*func)(void*), void* items, size_t item_size, unsigned int count) {
+    char* item = (char*)items;
+#ifndef IIR_GAUSS_BLUR_NO_THREADS
+    iir_gauss_blur_pool* pool = (ctx != NULL) ? (iir_gauss_blur_pool*)ctx->pool : NULL;
+    if (pool != NULL && pool->workers > 0 && count > 1) {
+        // Shares 1 to workers go to the workers, share 0 and the shares without a worker run here
+        unsigned int shared = ((unsigned int)pool->workers < count - 1) ? (unsigned int)pool->workers : count - 1;
+        pthread_mutex_lock(&pool->lock);
+        pool->func = func;
+        pool->items = item;
+        pool->item_size = item_size;
+        pool->count = (int)shared + 1;
+        pool->pending = (int)shared;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+        func(item);
+        for(unsigned int k = shared + 1; k < count; k++)
+            func(item + (size_t)k * item_size);
+        pthread_mutex_lock(&pool->lock);
+        while (pool->pending > 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+#endif
+    for(unsigned int k = 0; k < count; k++)
+        func(item + (size_t)k * item_size);
+}
+
+// Split `count` units of work into up to `threads` of the context contiguous shares and run func on each of them on
+// the workers of the context, the first share on the calling thread
+static void iir_gauss_blur_run(iir_gauss_blur_context* ctx, void* (*func)(void*), iir_gauss_blur_task* proto, unsigned int count, unsigned int unit) {
+    unsigned int shares = (count + unit - 1) / unit;
+    int threads = iir_gauss_blur_threads(count, unit, ctx->threads);
+    
+    iir_gauss_blur_task tasks[threads];
+    for(int k = 0; k < threads; k++) {
+        tasks[k] = *proto;
+        tasks[k].index = k;
+        tasks[k].begin = (unsigned int)((unsigned long long)shares * k / threads) * unit;
+        tasks[k].end = (unsigned int)((unsigned long long)shares * (k + 1) / threads) * unit;
+        if (tasks[k].end > count)
+            tasks[k].end = count;
+    }
+    iir_gauss_blur_context_dispatch(ctx, func, tasks, sizeof(tasks[0]), (unsigned int)threads);
+}
+
+// Bound of the difference between the fixed point and the float blur: each of the four passes rounds its
+// results by at most half a step, and that error goes through the remaining passes, each of which amplifies it by at most
+// the sum of the magnitudes of its impulse response.
+float iir_gauss_blur_fixed_deviation(float sigma) {
+    float c[5];
+    if (!iir_gauss_blur_coefficients(sigma, c))
+        return 0.0f;
+    double prev1 = c[0], prev2 = 0.0, prev3 = 0.0, gain = c[0];
+    for(unsigned int n = 0; n < 1000000 && fabs(prev1) + fabs(prev2) + fabs(prev3) > 1e-12; n++) {
+        double val = (c[2] * prev1 + c[3] * prev2 + c[4] * prev3) / c[1];
+        prev3 = prev2;
+        prev2 = prev1;
+        prev1 = val;
+        gain += fabs(val);
+    }
+    return (float)(0.5 / IIR_GAUSS_BLUR_FIXED_SCALE * (1.0 + gain + gain * gain + gain * gain * gain));
+}
+
+// The downsampling factor of the pyramid blur for sigma: the largest power of two that leaves a sigma of at least
+// IIR_GAUSS_BLUR_PYRAMID_SIGMA at the small size (1: no pyramid)
+unsigned int iir_gauss_blur_pyramid_factor(float sigma) {
+    unsigned int factor = 1;
+    while (factor < IIR_GAUSS_BLUR_PYRAMID_MAX && sigma / (2 * factor) >= IIR_GAUSS_BLUR_PYRAMID_SIGMA)
+        factor *= 2;
+    return factor;
+}
+
+// Response of both passes of a scanline filter with the coefficients c to an impulse in the middle of 2 * radius + 1
+// samples (the tails beyond them are negligible)
+static void iir_gauss_blur_response(const float* c, unsigned int radius, double* h) {
+    unsigned int n = 2 * radius + 1;
+    double prev1 = 0.0, prev2 = 0.0, prev3 = 0.0;
+    for(unsigned int i = 0; i < n; i++) {
+        h[i] = c[0] * ((i == radius) ? 1.0 : 0.0) + (c[2] * prev1 + c[3] * prev2 + c[4] * prev3) / c[1];
+        prev3 = prev2;
+        prev2 = prev1;
+        prev1 = h[i];
+    }
+    prev1 = prev2 = prev3 = 0.0;
+    for(unsigned int i = n; i-- > 0; ) {
+        h[i] = c[0] * h[i] + (c[2] * prev1 + c[3] * prev2 + c[4] * prev3) / c[1];
+        prev3 = prev2;
+        prev2 = prev1;
+        prev1 = h[i];
+    }
+}
+
+// Variance of the response of both passes with the coefficients c (a little larger than sigma^2)
+static double iir_gauss_blur_variance(const float* c, float sigma) {
+    unsigned int radius = (unsigned int)(20.0f * sigma) + 20;
+    double* h = (double*)malloc((2 * (size_t)radius + 1) * sizeof(double));
+    if (h == NULL)
+        return (double)sigma * sigma;
+    iir_gauss_blur_response(c, radius, h);
+    double sum = 0.0, moment = 0.0;
+    for(unsigned int i = 0; i < 2 * radius + 1; i++) {
+        double x = (double)i - radius;
+        sum += h[i];
+        moment += h[i] * x * x;
+    }
+    free(h);
+    return moment / sum;
+}
+
+// The sigma of the blur at the small size: the variance of downsampling (a box, (f^2 - 1) / 12), of the blur at the small
+// size and of the bilinear upsampling (f^2 / 6) add up to the variance of the blur of the full size (found by bisection)
+static float iir_gauss_blur_pyramid_sigma(float sigma, unsigned int factor) {
+    double f = factor;
+    float c[5];
+    if (!iir_gauss_blur_coefficients(sigma, c))
+        return 0.0f;
+    double target = (iir_gauss_blur_variance(c, sigma) - (f * f - 1.0) / 12.0 - f * f / 6.0) / (f * f);
+    float lo = 0.5f, hi = sigma / factor + 1.0f;
+    for(int k = 0; k < 32; k++) {
+        float mid = 0.5f * (lo + hi);
+        iir_gauss_blur_coefficients(mid, c);
+        if (iir_gauss_blur_variance(c, mid) < target)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return 0.5f * (lo + hi);
+}
+
+// Where the row or column `p` (of `n`) falls between the centers of the pixels of the small image (`f` pixels each, the
+// last one may have less): the pixel `s` before it and the weight `w` of the next one (0 before the first center and
+// after the last one)
+static void iir_gauss_blur_pyramid_position(unsigned int p, unsigned int n, unsigned int f, unsigned int* s, float* w) {
+    unsigned int ns = (n + f - 1) / f;
+    unsigned int k = p / f;
+    #pragma push_macro("CENTER")
+    #define CENTER(k) (((double)(k) * f + (((k) * f + f < n) ? (k) * f + f : n) - 1) * 0.5)
+    if (k > 0 && p < CENTER(k))
+        k--;
+    *s = k;
+    *w = 0.0f;
+    if (k + 1 < ns && p > CENTER(k))
+        *w = (float)((p - CENTER(k)) / (CENTER(k + 1) - CENTER(k)));
+    #pragma pop_macro("CENTER")
+}
+
+// Box downsampling of the rows `begin` to `end - 1` of the small image: every pixel is the mean of its factor x factor
+// pixels of the image (or of their luma). The sums are whole numbers, exact in floats.
+static void* iir_gauss_blur_downsample_task(void* arg) {
+    iir_gauss_blur_task* t = (iir_gauss_blur_task*)arg;
+    unsigned int f = t->factor, ws = (t->width + f - 1) / f;
+    unsigned char comps = t->components, step = t->step;
+    size_t srowlen = (size_t)ws * comps;
+    for(unsigned int ys = t->begin; ys < t->end; ys++) {
+        float* out = t->buffer + ys * srowlen;
+        unsigned int y0 = ys * f, y1 = (y0 + f < t->height) ? y0 + f : t->height;
+        for(size_t i = 0; i < srowlen; i++)
+            out[i] = 0.0f;
+        for(unsigned int y = y0; y < y1; y++) {
+            const unsigned char* src = t->image + (size_t)y * t->stride;
+            for(unsigned int xs = 0; xs < ws; xs++) {
+                unsigned int x0 = xs * f, x1 = (x0 + f < t->width) ? x0 + f : t->width;
+                for(unsigned char n = 0; n < comps; n++) {
+                    unsigned int sum = 0;
+                    if (t->luma) {
+                        for(unsigned int x = x0; x < x1; x++)
+                            sum += iir_gauss_blur_luma(src + (size_t)x * step, t->luma);
+                    } else {
+                        for(size_t i = (size_t)x0 * step + n; i < (size_t)x1 * step; i += step)
+                            sum += src[i];
+                    }
+                    out[(size_t)xs * comps + n] += (float)sum;
+                }
+            }
+        }
+        for(unsigned int xs = 0; xs < ws; xs++) {
+            unsigned int x1 = (xs * f + f < t->width) ? xs * f + f : t->width;
+            float count = (float)(y1 - y0) * (x1 - xs * f);
+            for(unsigned char n = 0; n < comps; n++)
+                out[(size_t)xs * comps + n] /= count;
+        }
+    }
+    return NULL;
+}
+
+// One row of the small image upsampled (bilinear) to the columns x0 to x1 - 1
+static void iir_gauss_blur_upsample_row(const iir_gauss_blur_task* t, const float* small, unsigned int x0, unsigned int x1, float* out) {
+    unsigned int ws = (t->width + t->factor - 1) / t->factor;
+    unsigned char comps = t->components;
+    for(unsigned int x = x0; x < x1; x++) {
+        const float* a = small + (size_t)t->xs[x] * comps;
+        const float* b = (t->xs[x] + 1 < ws) ? a + comps : a;
+        for(unsigned char n = 0; n < comps; n++)
+            *out++ = a[n] + t->xw[x] * (b[n] - a[n]);
+    }
+}
+
+// Bilinear upsampling of the blurred small image into the column blocks `begin` to `end - 1` of the buffer (or the fixed
+// point buffer), row by row: each finished piece of a row goes to row_func like in the last vertical pass of the blur.
+// The two rows of the small image around the row are upsampled along the row first (only when they change), then the
+// row is interpolated between them. `scratch` has those two rows (IIR_GAUSS_BLUR_BLOCK pixels each) and a row of the
+// image (the rounded values of a fixed point row) per task.
+static void* iir_gauss_blur_upsample_task(void* arg) {
+    iir_gauss_blur_task* t = (iir_gauss_blur_task*)arg;
+    unsigned int f = t->factor, ws = (t->width + f - 1) / f, hs = (t->height + f - 1) / f;
+    unsigned char comps = t->components;
+    size_t rowlen = (size_t)t->width * comps, srowlen = (size_t)ws * comps, piece = (size_t)IIR_GAUSS_BLUR_BLOCK * comps;
+    float* upper = t->scratch + (size_t)t->index * (2 * piece + rowlen);
+    float* lower = upper + piece;
+    float* out = lower + piece;
+    unsigned int xb = t->begin * IIR_GAUSS_BLUR_BLOCK;
+    unsigned int xe = (t->end < (t->width + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK) ? t->end * IIR_GAUSS_BLUR_BLOCK : t->width;
+    
+    for(unsigned int x0 = xb; x0 < xe; x0 += IIR_GAUSS_BLUR_BLOCK) {
+        unsigned int x1 = (xe - x0 > IIR_GAUSS_BLUR_BLOCK) ? x0 + IIR_GAUSS_BLUR_BLOCK : xe;
+        size_t i0 = (size_t)x0 * comps, n = (size_t)(x1 - x0) * comps;
+        unsigned int current = hs;
+        for(unsigned int y = 0; y < t->height; y++) {
+            unsigned int ys;
+            float wy;
+            iir_gauss_blur_pyramid_position(y, t->height, f, &ys, &wy);
+            if (ys != current) {
+                // ys only grows: the lower row of the last one is the upper row of this one
+                if (ys == current + 1) {
+                    float* swap = upper;
+                    upper = lower;
+                    lower = swap;
+                } else {
+                    iir_gauss_blur_upsample_row(t, t->small + ys * srowlen, x0, x1, upper);
+                }
+                iir_gauss_blur_upsample_row(t, t->small + ((ys + 1 < hs) ? ys + 1 : ys) * srowlen, x0, x1, lower);
+                current = ys;
+            }
+            float* row = t->fixed ? out : t->buffer + y * rowlen;
+            for(size_t i = 0; i < n; i++)
+                row[i0 + i] = upper[i] + wy * (lower[i] - upper[i]);
+            if (t->fixed) {
+                unsigned short* q = t->fixed + y * rowlen;
+                for(size_t i = i0; i < i0 + n; i++) {
+                    q[i] = iir_gauss_blur_to_fixed(out[i]);
+                    out[i] = IIR_GAUSS_BLUR_FROM_FIXED(q[i]);
+                }
+            }
+            if (t->row_func != NULL)
+                t->row_func(t->user, y, x0, x1, row);
+        }
+    }
+    return NULL;
+}
+
+// The scratch buffer of the context with at least `size` bytes: it only grows (the old one is freed, not copied)
+static void* iir_gauss_blur_context_scratch(iir_gauss_blur_context* ctx, size_t size) {
+    if (size > ctx->scratch_size) {
+        free(ctx->scratch);
+        ctx->scratch = malloc(size);
+        ctx->scratch_size = (ctx->scratch != NULL) ? size : 0;
+    }
+    return ctx->scratch;
+}
+
+void iir_gauss_blur_context_init(iir_gauss_blur_context* ctx, float sigma, int threads, int pyramid) {
+    ctx->sigma = sigma;
+    ctx->threads = threads;
+    ctx->blur = iir_gauss_blur_coefficients(sigma, ctx->c);
+    ctx->factor = (pyramid && ctx->blur) ? iir_gauss_blur_pyramid_factor(sigma) : 1;
+    if (ctx->factor < 2 || !iir_gauss_blur_coefficients(iir_gauss_blur_pyramid_sigma(sigma, ctx->factor), ctx->cs)) {
+        ctx->factor = 1;
+        memcpy(ctx->cs, ctx->c, sizeof(ctx->c));
+    }
+    ctx->scratch = NULL;
+    ctx->scratch_size = 0;
+#ifndef IIR_GAUSS_BLUR_NO_THREADS
+    ctx->pool = iir_gauss_blur_pool_start(threads);
+#else
+    ctx->pool = NULL;
+#endif
+}
+
+void iir_gauss_blur_context_free(iir_gauss_blur_context* ctx) {
+    free(ctx->scratch);
+    ctx->scratch = NULL;
+    ctx->scratch_size = 0;
+#ifndef IIR_GAUSS_BLUR_NO_THREADS
+    iir_gauss_blur_pool_stop((iir_gauss_blur_pool*)ctx->pool);
+#endif
+    ctx->pool = NULL;
+}
+
+int iir_gauss_blur_context_run(iir_gauss_blur_context* ctx, unsigned int width, unsigned int height, unsigned char components, unsigned char luma, const unsigned char* image, size_t stride, unsigned char step, float* buffer, unsigned short* fixed, iir_gauss_blur_row_func row_func, void* user) {
+    if (luma)
+        components = 1;
+    if (step == 0)
+        step = luma ? luma : components;
+    if (stride == 0)
+        stride = (size_t)width * step;
+    size_t rowlen = (size_t)width * components;
+    unsigned int blocks = (width + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK;
+    int threads = iir_gauss_blur_threads(blocks, 1, ctx->threads);
+    iir_gauss_blur_task task = { width, height, components, image, buffer, ctx->c, 0, 0, row_func, user, 3, 0, fixed, NULL, 0, luma, NULL, 0, NULL, NULL, stride, step };
+    
+    if (!ctx->blur) {
+        // No blur at all: the result is the image itself
+        float* out = (fixed != NULL && row_func != NULL) ? (float*)iir_gauss_blur_context_scratch(ctx, rowlen * sizeof(float)) : NULL;
+        if (fixed != NULL && row_func != NULL && out == NULL)
+            return 0;
         for(unsigned int y = 0; y < height; y++) {
-            for(unsigned char n = 0; n < components; n++) {
-                float val = B * buffer[IDX(x, y, n)] + (b1 * prev1[n] + b2 * prev2[n] + b3 * prev3[n]) / b0;
-                buffer[IDX(x, y, n)] = val;
-                prev3[n] = prev2[n];
-                prev2[n] = prev1[n];
-                prev1[n] = val;
+            const unsigned char* src = image + (size_t)y * stride;
+            float* row = (buffer != NULL) ? buffer + (size_t)y * rowlen : NULL;
+            unsigned short* q = (fixed != NULL) ? fixed + (size_t)y * rowlen : NULL;
+            for(unsigned int x = 0; x < width; x++) {
+                for(unsigned char n = 0; n < components; n++) {
+                    size_t i = (size_t)x * components + n;
+                    float v = luma ? iir_gauss_blur_luma(src + (size_t)x * step, luma) : src[(size_t)x * step + n];
+                    if (fixed != NULL)
+                        q[i] = iir_gauss_blur_to_fixed(v);
+                    else
+                        row[i] = v;
+                }
+            }
+            if (out != NULL) {
+                for(size_t i = 0; i < rowlen; i++)
+                    out[i] = IIR_GAUSS_BLUR_FROM_FIXED(q[i]);
+                row_func(user, y, 0, width, out);
+            } else if (row_func != NULL) {
+                row_func(user, y, 0, width, row);
             }
         }
+        return 1;
     }
     
-    // Vertical backward pass (from paper: Implement the backward filter with equation 9b)
-    // Also write the result back into the byte image
-    for(unsigned int x = width-1; x < width; x--) {
-        float prev1[components], prev2[components], prev3[components];
-        for(unsigned char n = 0; n < components; n++) {
-            prev1[n] = buffer[IDX(x, height-1, n)];
-            prev2[n] = prev1[n];
-            prev3[n] = prev2[n];
+    if (ctx->factor > 1) {
+        // Pyramid: the small image, the upsampling rows of every task and the positions of the columns in the scratch
+        unsigned int f = ctx->factor, ws = (width + f - 1) / f, hs = (height + f - 1) / f;
+        size_t nsmall = (size_t)hs * ws * components, nrows = (size_t)threads * (2 * (size_t)IIR_GAUSS_BLUR_BLOCK * components + rowlen);
+        float* small = (float*)iir_gauss_blur_context_scratch(ctx, (nsmall + nrows + width) * sizeof(float) + (size_t)width * sizeof(unsigned int));
+        if (small == NULL)
+            return 0;
+        float* xw = small + nsmall + nrows;
+        unsigned int* xs = (unsigned int*)(xw + width);
+        for(unsigned int x = 0; x < width; x++)
+            iir_gauss_blur_pyramid_position(x, width, f, &xs[x], &xw[x]);
+        
+        // Downsample, blur the small image (its float buffer in place) and upsample it into the buffer
+        task.buffer = small;
+        task.fixed = NULL;
+        task.c = ctx->cs;
+        task.factor = f;
+        iir_gauss_blur_run(ctx, iir_gauss_blur_downsample_task, &task, hs, 1);
+        iir_gauss_blur_task blur = { ws, hs, components, NULL, small, ctx->cs, 0, 0, NULL, NULL, 3, 0, NULL, NULL, 0, 0, NULL, 0, NULL, NULL, 0, 0 };
+        iir_gauss_blur_run(ctx, iir_gauss_blur_rows_task, &blur, hs, IIR_GAUSS_BLUR_LANES);
+        iir_gauss_blur_run(ctx, iir_gauss_blur_columns_task, &blur, (ws + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK, 1);
+        task.buffer = buffer;
+        task.fixed = fixed;
+        task.scratch = small + nsmall;
+        task.small = small;
+        task.xs = xs;
+        task.xw = xw;
+        iir_gauss_blur_run(ctx, iir_gauss_blur_upsample_task, &task, blocks, 1);
+        return 1;
+    }
+    
+    if (fixed != NULL) {
+        // The horizontal passes of the fixed point buffer filter IIR_GAUSS_BLUR_LANES float rows per task, the
+        // vertical passes keep 5 float rows per task
+        size_t rows_h = (size_t)iir_gauss_blur_threads(height, IIR_GAUSS_BLUR_LANES, ctx->threads) * IIR_GAUSS_BLUR_LANES;
+        size_t rows_v = (size_t)threads * 5;
+        task.scratch = (float*)iir_gauss_blur_context_scratch(ctx, ((rows_h > rows_v) ? rows_h : rows_v) * rowlen * sizeof(float));
+        if (task.scratch == NULL)
+            return 0;
+    }
+    // First both horizontal passes over shares of the scanlines (in groups of vector lanes),
+    // then both vertical passes over shares of the column blocks
+    iir_gauss_blur_run(ctx, iir_gauss_blur_rows_task, &task, height, IIR_GAUSS_BLUR_LANES);
+    iir_gauss_blur_run(ctx, iir_gauss_blur_columns_task, &task, blocks, 1);
+    return 1;
+}
+
+// Difference between the pyramid blur and the full size blur at a straight edge from 0 to 255, away from the borders.
+// Both are separable: along a row (or column) the pyramid is the kernel K_p of downsampling, small blur and upsampling,
+// which depends on the phase p of the pixel in its box, the full blur the kernel h. The difference at the edge is the
+// largest difference of the step responses (the running sums of K_p - h) times the gain of the kernel along the edge,
+// plus the difference of the gains. (The sum of the magnitudes of K_p - h bounds the difference for any image, but at
+// 20 to 30 gray levels it says nothing about real pages.)
+float iir_gauss_blur_pyramid_deviation(float sigma) {
+    unsigned int f = iir_gauss_blur_pyramid_factor(sigma);
+    float c[5], cs[5];
+    if (f < 2 || !iir_gauss_blur_coefficients(sigma, c) || !iir_gauss_blur_coefficients(iir_gauss_blur_pyramid_sigma(sigma, f), cs))
+        return 0.0f;
+    unsigned int radius = (unsigned int)(16.0f * sigma) + 4 * f + 16;
+    unsigned int sradius = radius / f + 4;
+    double* h = (double*)malloc((2 * (size_t)radius + 1) * sizeof(double));
+    double* hs = (double*)malloc((2 * (size_t)sradius + 1) * sizeof(double));
+    if (h == NULL || hs == NULL) {
+        free(h);
+        free(hs);
+        return 255.0f;
+    }
+    iir_gauss_blur_response(c, radius, h);
+    iir_gauss_blur_response(cs, sradius, hs);
+    double gain_h = 0.0, step = 0.0, gain_k = 0.0, gain_diff = 0.0;
+    for(unsigned int i = 0; i < 2 * radius + 1; i++)
+        gain_h += h[i];
+    // Pixel p of the box around 0 (the boxes start at multiples of f, far from the borders), impulse at p + m
+    for(unsigned int p = 0; p < f; p++) {
+        double u = (p + 0.5) / f - 0.5;
+        long s0 = (long)floor(u);
+        double w = u - s0;
+        double gain = 0.0, sum = 0.0;
+        for(long m = -(long)radius; m <= (long)radius; m++) {
+            long sm = (long)floor((double)(p + m) / f);
+            long j0 = (long)sradius + s0 - sm, j1 = j0 + 1;
+            double km = ((j0 >= 0 && j0 <= 2 * (long)sradius) ? (1.0 - w) * hs[j0] : 0.0)
+                + ((j1 >= 0 && j1 <= 2 * (long)sradius) ? w * hs[j1] : 0.0);
+            km /= f;
+            gain += km;
+            sum += km - h[radius - m];
+            step = (fabs(sum) > step) ? fabs(sum) : step;
+        }
+        gain_k = (fabs(gain) > gain_k) ? fabs(gain) : gain_k;
+        gain_diff = (fabs(gain - gain_h) > gain_diff) ? fabs(gain - gain_h) : gain_diff;
+    }
+    free(h);
+    free(hs);
+    return (float)(255.0 * (step * gain_k + gain_diff));
+}
+
+// Number of rows after which wrong start values (each off by up to 255) of the recursion have decayed below
+// IIR_GAUSS_BLUR_STRIP_TOLERANCE: the margin below a strip that the backward pass needs to settle.
+// The error is a sum of the responses to an error in each of the three start values, bound by the sum of their magnitudes.
+static unsigned int iir_gauss_blur_margin(const float* c) {
+    double prev1[3] = { 1.0, 0.0, 0.0 }, prev2[3] = { 0.0, 1.0, 0.0 }, prev3[3] = { 0.0, 0.0, 1.0 };
+    unsigned int n = 0, settled = 0;
+    while (settled < 3) {
+        double bound = 0.0;
+        for(int j = 0; j < 3; j++) {
+            double val = (c[2] * prev1[j] + c[3] * prev2[j] + c[4] * prev3[j]) / c[1];
+            prev3[j] = prev2[j];
+            prev2[j] = prev1[j];
+            prev1[j] = val;
+            bound += fabs(val);
         }
+        settled = (255.0 * bound < IIR_GAUSS_BLUR_STRIP_TOLERANCE) ? settled + 1 : 0;
+        n++;
+    }
+    return n;
+}
+
+int iir_gauss_blur_strips(unsigned int width, unsigned int height, unsigned char components, float sigma, unsigned int strip, int threads, iir_gauss_blur_read_func read_func, iir_gauss_blur_strip_func strip_func, void* user) {
+    size_t rowlen = (size_t)width * components;
+    // A context of its own for the coefficients and the workers of all strips
+    iir_gauss_blur_context ctx;
+    iir_gauss_blur_context_init(&ctx, sigma, threads, 0);
+    const float* c = ctx.c;
+    int blur = ctx.blur;
+    unsigned int margin = blur ? iir_gauss_blur_margin(c) : 0;
+    if (strip < 1)
+        strip = (margin > 64) ? margin : 64;
+    
+    // Window: the rows from 3 above the current strip (start values of the vertical forward pass) to the margin below it
+    unsigned int capacity = strip + margin + 3;
+    unsigned char* bytes = (unsigned char*)malloc((size_t)capacity * rowlen);
+    float* window = (float*)malloc((size_t)capacity * rowlen * sizeof(float));
+    float* out = (float*)malloc((size_t)(strip + margin) * rowlen * sizeof(float));
+    if (bytes == NULL || window == NULL || out == NULL) {
+        free(bytes);
+        free(window);
+        free(out);
+        iir_gauss_blur_context_free(&ctx);
+        return 0;
+    }
+    
+    int ok = 1;
+    unsigned int wy = 0, wn = 0;    // the window holds the rows wy to wy + wn - 1
+    iir_gauss_blur_task task = { width, 0, components, bytes, window, c, 0, 0, NULL, NULL, 1, 0, NULL, NULL, 0, 0, NULL, 0, NULL, NULL, rowlen, components };
+    for(unsigned int y0 = 0; ok && y0 < height; y0 += strip) {
+        unsigned int y1 = (height - y0 > strip) ? y0 + strip : height;
+        unsigned int ye = (height - y1 > margin) ? y1 + margin : height;
         
-        for(unsigned int y = height-1; y < height; y--) {
-            for(unsigned char n = 0; n < components; n++) {
-                float val = B * buffer[IDX(x, y, n)] + (b1 * prev1[n] + b2 * prev2[n] + b3 * prev3[n]) / b0;
-                image[IDX(x, y, n)] = val;
-                prev3[n] = prev2[n];
-                prev2[n] = prev1[n];
-                prev1[n] = val;
+        // Read the missing rows, both horizontal passes and the vertical forward pass continue the rows above
+        if (wy + wn < ye) {
+            unsigned int n = ye - wy - wn;
+            if (!read_func(user, wy + wn, n, bytes + (size_t)wn * rowlen)) {
+                ok = 0;
+                break;
+            }
+            if (blur) {
+                task.image = bytes + (size_t)wn * rowlen;
+                task.buffer = window + (size_t)wn * rowlen;
+                iir_gauss_blur_run(&ctx, iir_gauss_blur_rows_task, &task, n, IIR_GAUSS_BLUR_LANES);
+                task.height = wn + n;
+                task.buffer = window;
+                task.passes = 1;
+                task.first = wn;
+                iir_gauss_blur_run(&ctx, iir_gauss_blur_columns_task, &task, (width + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK, 1);
+            } else {
+                for(size_t i = (size_t)wn * rowlen; i < (size_t)(wn + n) * rowlen; i++)
+                    window[i] = bytes[i];
             }
+            wn += n;
+        }
+        
+        // The vertical backward pass starts at the margin below the strip (or the bottom of the image) on a copy
+        unsigned int off = y0 - wy, rows = ye - y0;
+        for(size_t i = 0; i < (size_t)rows * rowlen; i++)
+            out[i] = window[(size_t)off * rowlen + i];
+        if (blur) {
+            iir_gauss_blur_task back = task;
+            back.height = rows;
+            back.buffer = out;
+            back.passes = 2;
+            back.first = 0;
+            iir_gauss_blur_run(&ctx, iir_gauss_blur_columns_task, &back, (width + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK, 1);
+        }
+        for(unsigned int y = y0; y < y1; y++)
+            strip_func(user, y, bytes + (size_t)(off + y - y0) * rowlen, out + (size_t)(y - y0) * rowlen);
+        
+        // Slide the window down to 3 rows above the next strip
+        unsigned int keep = (y1 - wy > 3) ? y1 - 3 - wy : 0;
+        if (keep > 0) {
+            memmove(bytes, bytes + (size_t)keep * rowlen, (size_t)(wn - keep) * rowlen);
+            memmove(window, window + (size_t)keep * rowlen, (size_t)(wn - keep) * rowlen * sizeof(float));
+            wy += keep;
+            wn -= keep;
         }
     }
     
-    // Free temporary buffers and restore any potential IDX macro
+    free(bytes);
+    free(window);
+    free(out);
+    iir_gauss_blur_context_free(&ctx);
+    return ok;
+}
+
+void iir_gauss_blur(unsigned int width, unsigned int height, unsigned char components, unsigned char* image, float sigma) {
+    float c[5];
+    if (!iir_gauss_blur_coefficients(sigma, c))
+        return;
+    
+    // Allocate buffers
+    size_t size = (size_t)width * height * components;
+    float* buffer = (float*)malloc(size * sizeof(buffer[0]));
+    if (buffer == NULL)
+        return;
+    
+    // Blur into the float buffer on the calling thread and write the result back into the byte image
+    iir_gauss_blur_context ctx;
+    iir_gauss_blur_context_init(&ctx, sigma, 1, 0);
+    iir_gauss_blur_context_run(&ctx, width, height, components, 0, image, 0, 0, buffer, NULL, NULL, NULL);
+    iir_gauss_blur_context_free(&ctx);
+    for(size_t i = 0; i < size; i++) {
+        float val = buffer[i];
+        image[i] = (val > 0.0f) ? ((val < 255.0f) ? (unsigned char)val : 255) : 0;
+    }
+    
+    // Free temporary buffers
     free(buffer);
-    #pragma pop_macro("IDX")
 }
 #endif  // IIR_GAUSS_BLUR_IMPLEMENTATION
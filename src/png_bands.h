@@ -0,0 +1,1217 @@
+/**
+
+PNG bands v1.1
+This is free and unencumbered software released into the public domain.
+
+A PNG encoder for large images that deflates on several threads. The rows are split into bands of about PNG_BANDS_SIZE
+filtered bytes, and every band is filtered, deflated and checksummed on its own into an IDAT chunk of its own:
+
+  - a band that is not the last one ends with an empty stored block (a sync flush), so its deflate blocks end on a byte
+    boundary and the bands concatenate into one valid zlib stream;
+  - the deflate of a band looks back into the 32 KB in front of it (the end of the band above is filtered once more as
+    its dictionary), so the stream is about as small as one deflated in one piece;
+  - the Adler-32 of the stream is combined from the ones of the bands.
+
+The bands only depend on the size of the image, not on the number of threads: the file is the same for any number of
+threads. Any PNG reader decodes it.
+
+QUICK START
+
+    #include ...
+    #define PNG_BANDS_IMPLEMENTATION
+    #include "png_bands.h"
+    ...
+    int ok = png_bands_write(write_func, user, width, height, components, depth, image, stride, level, threads);
+
+`write_func(user, data, size)` gets the file piece by piece, in order (it returns 0 to fail the write). `image` has
+`height` rows `stride` bytes apart. Every row has `width * components` samples of `depth` bits: 8, or 1 for a gray image
+(8 pixels per byte, the first one in the high bit, 1 = white). `level` trades speed for size like the levels of zlib:
+0 stores the data as it is, 1 is the fastest and 9 the smallest (PNG_BANDS_LEVEL_DEFAULT is 6). The bands are deflated
+on up to `threads` threads (pthreads, none if PNG_BANDS_NO_THREADS is defined). Returns 0 if there is no memory or
+write_func failed.
+
+STREAM
+
+    png_bands_stream* stream = png_bands_begin(write_func, user, width, height, components, depth, level, threads);
+    for (...)
+        ok = ok && png_bands_rows(stream, rows, stride, count);
+    ok = png_bands_end(stream) && ok;
+
+writes the same file from rows that come in top down, `count` rows `stride` bytes apart at a time, without the whole
+image in memory. The rows are copied into a buffer of `threads` bands (and the rows above them that the first one looks
+back into); as soon as it is full the bands are deflated on the threads and written out as IDAT chunks. png_bands_begin()
+writes the header (it returns NULL if there is no memory or write_func failed), png_bands_end() the end of the file
+after the last row and frees the stream (it returns 0 if a row was missing, there was no memory or write_func failed).
+
+FILTERS
+
+Every row has a filter that makes it easier to compress. For the 1 bit rows it is None, as the PNG specification
+recommends for bit depths below 8. An 8 bit row gets the one of None, Sub and Up that suits it:
+
+  - a bilevel row (only 0 and 255 per sample, like a thresholded page) is counted in runs of equal bytes, as a long
+    run is a cheap deflate match and a run of a byte is not. It gets Up (where it repeats the row above) or Sub (wide
+    black areas) if that has less than half the runs of None, else None: deflate matches a None row against the rows
+    above it anyway, and noise or fine text only gets more edges from Sub and Up;
+  - any other row the one with the smallest sum of absolute differences (as signed bytes), the usual heuristic.
+
+Average and Paeth spread the edges of bilevel data over more distinct bytes and are not used. On thresholded pages the
+files are up to 20 % smaller than with the sum of absolute differences (which picks Sub or Up for almost every bilevel
+row), a few are a few percent larger.
+
+DEFLATE
+
+Hash chains find the matches in a window of 32 KB, searched the way zlib searches them at the same level. Every
+block of up to PNG_BANDS_BLOCK symbols gets its own Huffman codes (length limited, at most 15 bits). A block that would
+be larger than its bytes is stored instead.
+
+VERSION HISTORY
+
+1.0  2026-10-17  "init"    Initial release.
+1.1  2026-10-17  "stream"  The rows of an image can be given piece by piece (png_bands_begin, _rows, _end).
+
+**/
+#ifndef PNG_BANDS_H
+#define PNG_BANDS_H
+#include <stddef.h>
+#ifdef __cplusplus
+    extern "C" {
+#endif
+
+#define PNG_BANDS_LEVEL_DEFAULT 6
+
+typedef int (*png_bands_write_func)(void* user, const unsigned char* data, size_t size);
+typedef struct png_bands_stream png_bands_stream;
+
+int png_bands_write(png_bands_write_func write_func, void* user, unsigned int width, unsigned int height, unsigned char components, unsigned char depth, const unsigned char* image, size_t stride, int level, int threads);
+png_bands_stream* png_bands_begin(png_bands_write_func write_func, void* user, unsigned int width, unsigned int height, unsigned char components, unsigned char depth, int level, int threads);
+int png_bands_rows(png_bands_stream* stream, const unsigned char* rows, size_t stride, unsigned int count);
+int png_bands_end(png_bands_stream* stream);
+unsigned int png_bands_crc32(unsigned int crc, const unsigned char* data, size_t size);
+unsigned int png_bands_adler32(unsigned int adler, const unsigned char* data, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+#endif  /* PNG_BANDS_H */
+
+#ifdef PNG_BANDS_IMPLEMENTATION
+#include <stdlib.h>
+#include <string.h>
+#ifndef PNG_BANDS_NO_THREADS
+#include <pthread.h>
+#endif
+
+#ifndef PNG_BANDS_SIZE
+#define PNG_BANDS_SIZE (1 << 18)
+#endif
+#ifndef PNG_BANDS_BLOCK
+#define PNG_BANDS_BLOCK 16384
+#endif
+#ifndef PNG_BANDS_THREADS_MAX
+#define PNG_BANDS_THREADS_MAX 256
+#endif
+
+#define PNG_BANDS_WINDOW 32768
+#define PNG_BANDS_HASH_BITS 15
+#define PNG_BANDS_MATCH_MIN 3
+#define PNG_BANDS_MATCH_MAX 258
+
+/* the search of every level (the one of zlib): a quarter of the chain is walked once a match is `good`, a match is
+   only checked for a longer one one byte later (lazy, from level 4 on) if it is shorter than `lazy`, a match of `nice`
+   is taken as it is, at most `chain` candidates are tried (levels 1 to 3 only hash the positions in matches up to
+   `lazy`) */
+static const struct
+{
+    unsigned short good, lazy, nice, chain;
+} png_bands_levels[10] = {{0, 0, 0, 0}, {4, 4, 8, 4}, {4, 5, 16, 8}, {4, 6, 32, 32}, {4, 4, 16, 16},
+    {8, 16, 32, 32}, {8, 16, 128, 128}, {8, 32, 128, 256}, {32, 128, 258, 1024}, {32, 258, 258, 4096}};
+
+/* the CRC-32 of every byte (polynomial 0xedb88320), precomputed: the threads of the bands read it at the same time */
+static const unsigned int png_bands_crc_table[256] = {
+    0x00000000u, 0x77073096u, 0xee0e612cu, 0x990951bau, 0x076dc419u, 0x706af48fu, 0xe963a535u, 0x9e6495a3u,
+    0x0edb8832u, 0x79dcb8a4u, 0xe0d5e91eu, 0x97d2d988u, 0x09b64c2bu, 0x7eb17cbdu, 0xe7b82d07u, 0x90bf1d91u,
+    0x1db71064u, 0x6ab020f2u, 0xf3b97148u, 0x84be41deu, 0x1adad47du, 0x6ddde4ebu, 0xf4d4b551u, 0x83d385c7u,
+    0x136c9856u, 0x646ba8c0u, 0xfd62f97au, 0x8a65c9ecu, 0x14015c4fu, 0x63066cd9u, 0xfa0f3d63u, 0x8d080df5u,
+    0x3b6e20c8u, 0x4c69105eu, 0xd56041e4u, 0xa2677172u, 0x3c03e4d1u, 0x4b04d447u, 0xd20d85fdu, 0xa50ab56bu,
+    0x35b5a8fau, 0x42b2986cu, 0xdbbbc9d6u, 0xacbcf940u, 0x32d86ce3u, 0x45df5c75u, 0xdcd60dcfu, 0xabd13d59u,
+    0x26d930acu, 0x51de003au, 0xc8d75180u, 0xbfd06116u, 0x21b4f4b5u, 0x56b3c423u, 0xcfba9599u, 0xb8bda50fu,
+    0x2802b89eu, 0x5f058808u, 0xc60cd9b2u, 0xb10be924u, 0x2f6f7c87u, 0x58684c11u, 0xc1611dabu, 0xb6662d3du,
+    0x76dc4190u, 0x01db7106u, 0x98d220bcu, 0xefd5102au, 0x71b18589u, 0x06b6b51fu, 0x9fbfe4a5u, 0xe8b8d433u,
+    0x7807c9a2u, 0x0f00f934u, 0x9609a88eu, 0xe10e9818u, 0x7f6a0dbbu, 0x086d3d2du, 0x91646c97u, 0xe6635c01u,
+    0x6b6b51f4u, 0x1c6c6162u, 0x856530d8u, 0xf262004eu, 0x6c0695edu, 0x1b01a57bu, 0x8208f4c1u, 0xf50fc457u,
+    0x65b0d9c6u, 0x12b7e950u, 0x8bbeb8eau, 0xfcb9887cu, 0x62dd1ddfu, 0x15da2d49u, 0x8cd37cf3u, 0xfbd44c65u,
+    0x4db26158u, 0x3ab551ceu, 0xa3bc0074u, 0xd4bb30e2u, 0x4adfa541u, 0x3dd895d7u, 0xa4d1c46du, 0xd3d6f4fbu,
+    0x4369e96au, 0x346ed9fcu, 0xad678846u, 0xda60b8d0u, 0x44042d73u, 0x33031de5u, 0xaa0a4c5fu, 0xdd0d7cc9u,
+    0x5005713cu, 0x270241aau, 0xbe0b1010u, 0xc90c2086u, 0x5768b525u, 0x206f85b3u, 0xb966d409u, 0xce61e49fu,
+    0x5edef90eu, 0x29d9c998u, 0xb0d09822u, 0xc7d7a8b4u, 0x59b33d17u, 0x2eb40d81u, 0xb7bd5c3bu, 0xc0ba6cadu,
+    0xedb88320u, 0x9abfb3b6u, 0x03b6e20cu, 0x74b1d29au, 0xead54739u, 0x9dd277afu, 0x04db2615u, 0x73dc1683u,
+    0xe3630b12u, 0x94643b84u, 0x0d6d6a3eu, 0x7a6a5aa8u, 0xe40ecf0bu, 0x9309ff9du, 0x0a00ae27u, 0x7d079eb1u,
+    0xf00f9344u, 0x8708a3d2u, 0x1e01f268u, 0x6906c2feu, 0xf762575du, 0x806567cbu, 0x196c3671u, 0x6e6b06e7u,
+    0xfed41b76u, 0x89d32be0u, 0x10da7a5au, 0x67dd4accu, 0xf9b9df6fu, 0x8ebeeff9u, 0x17b7be43u, 0x60b08ed5u,
+    0xd6d6a3e8u, 0xa1d1937eu, 0x38d8c2c4u, 0x4fdff252u, 0xd1bb67f1u, 0xa6bc5767u, 0x3fb506ddu, 0x48b2364bu,
+    0xd80d2bdau, 0xaf0a1b4cu, 0x36034af6u, 0x41047a60u, 0xdf60efc3u, 0xa867df55u, 0x316e8eefu, 0x4669be79u,
+    0xcb61b38cu, 0xbc66831au, 0x256fd2a0u, 0x5268e236u, 0xcc0c7795u, 0xbb0b4703u, 0x220216b9u, 0x5505262fu,
+    0xc5ba3bbeu, 0xb2bd0b28u, 0x2bb45a92u, 0x5cb36a04u, 0xc2d7ffa7u, 0xb5d0cf31u, 0x2cd99e8bu, 0x5bdeae1du,
+    0x9b64c2b0u, 0xec63f226u, 0x756aa39cu, 0x026d930au, 0x9c0906a9u, 0xeb0e363fu, 0x72076785u, 0x05005713u,
+    0x95bf4a82u, 0xe2b87a14u, 0x7bb12baeu, 0x0cb61b38u, 0x92d28e9bu, 0xe5d5be0du, 0x7cdcefb7u, 0x0bdbdf21u,
+    0x86d3d2d4u, 0xf1d4e242u, 0x68ddb3f8u, 0x1fda836eu, 0x81be16cdu, 0xf6b9265bu, 0x6fb077e1u, 0x18b74777u,
+    0x88085ae6u, 0xff0f6a70u, 0x66063bcau, 0x11010b5cu, 0x8f659effu, 0xf862ae69u, 0x616bffd3u, 0x166ccf45u,
+    0xa00ae278u, 0xd70dd2eeu, 0x4e048354u, 0x3903b3c2u, 0xa7672661u, 0xd06016f7u, 0x4969474du, 0x3e6e77dbu,
+    0xaed16a4au, 0xd9d65adcu, 0x40df0b66u, 0x37d83bf0u, 0xa9bcae53u, 0xdebb9ec5u, 0x47b2cf7fu, 0x30b5ffe9u,
+    0xbdbdf21cu, 0xcabac28au, 0x53b39330u, 0x24b4a3a6u, 0xbad03605u, 0xcdd70693u, 0x54de5729u, 0x23d967bfu,
+    0xb3667a2eu, 0xc4614ab8u, 0x5d681b02u, 0x2a6f2b94u, 0xb40bbe37u, 0xc30c8ea1u, 0x5a05df1bu, 0x2d02ef8du
+};
+
+unsigned int png_bands_crc32(unsigned int crc, const unsigned char* data, size_t size)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = png_bands_crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+unsigned int png_bands_adler32(unsigned int adler, const unsigned char* data, size_t size)
+{
+    unsigned int a = adler & 0xffff, b = adler >> 16;
+    while (size > 0)
+    {
+        /* 5552 bytes can't overflow the sums before the modulo */
+        size_t n = (size < 5552) ? size : 5552;
+        size -= n;
+        for (size_t i = 0; i < n; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        data += n;
+        a %= 65521;
+        b %= 65521;
+    }
+    return (b << 16) | a;
+}
+
+/* the Adler-32 of two pieces one after the other from the ones of the pieces (`size2` bytes in the second one) */
+static unsigned int png_bands_adler32_combine(unsigned int adler1, unsigned int adler2, size_t size2)
+{
+    const unsigned int base = 65521;
+    unsigned int rem = (unsigned int)(size2 % base);
+    unsigned int sum1 = adler1 & 0xffff;
+    unsigned int sum2 = (unsigned int)(((unsigned long long)rem * sum1) % base);
+    sum1 += (adler2 & 0xffff) + base - 1;
+    sum2 += (adler1 >> 16) + (adler2 >> 16) + base - rem;
+    sum1 = (sum1 >= base) ? sum1 - base : sum1;
+    sum1 = (sum1 >= base) ? sum1 - base : sum1;
+    sum2 = (sum2 >= 2 * base) ? sum2 - 2 * base : sum2;
+    sum2 = (sum2 >= base) ? sum2 - base : sum2;
+    return (sum2 << 16) | sum1;
+}
+
+/* the deflate stream of a band: bytes and the bits that don't fill a byte yet (LSB first) */
+typedef struct
+{
+    unsigned char* data;
+    size_t size, capacity;
+    unsigned long long bits;
+    unsigned int count;
+    int failed;
+} png_bands_out;
+
+static int png_bands_reserve(png_bands_out* out, size_t size)
+{
+    if (out->size + size > out->capacity)
+    {
+        size_t capacity = (out->capacity > 0) ? 2 * out->capacity : 65536;
+        while (capacity < out->size + size)
+        {
+            capacity *= 2;
+        }
+        unsigned char* data = (unsigned char*)realloc(out->data, capacity);
+        if (data == NULL)
+        {
+            out->failed = 1;
+            return 0;
+        }
+        out->data = data;
+        out->capacity = capacity;
+    }
+    return 1;
+}
+
+/* n bits (up to 32) of value, room has to be reserved */
+static inline void png_bands_put(png_bands_out* out, unsigned int value, unsigned int n)
+{
+    out->bits |= (unsigned long long)value << out->count;
+    out->count += n;
+    while (out->count >= 8)
+    {
+        out->data[out->size++] = (unsigned char)out->bits;
+        out->bits >>= 8;
+        out->count -= 8;
+    }
+}
+
+/* zero bits up to the next byte */
+static inline void png_bands_align(png_bands_out* out)
+{
+    png_bands_put(out, 0, (8 - out->count) & 7);
+}
+
+/* the length codes (257 to 285) and distance codes (0 to 29) with their extra bits */
+static inline unsigned int png_bands_highest_bit(unsigned int v)
+{
+    unsigned int b = 0;
+    while (v >>= 1)
+    {
+        b++;
+    }
+    return b;
+}
+
+static inline unsigned int png_bands_length_code(unsigned int length, unsigned int* extra, unsigned int* value)
+{
+    unsigned int l = length - PNG_BANDS_MATCH_MIN;
+    if ((l < 8) || (l == 255))
+    {
+        *extra = 0;
+        *value = 0;
+        return (l < 8) ? 257 + l : 285;
+    }
+    unsigned int b = png_bands_highest_bit(l);
+    unsigned int code = 257 + 4 * (b - 1) + ((l >> (b - 2)) & 3);
+    *extra = b - 2;
+    *value = l & ((1u << (b - 2)) - 1);
+    return code;
+}
+
+static inline unsigned int png_bands_distance_code(unsigned int distance, unsigned int* extra, unsigned int* value)
+{
+    unsigned int d = distance - 1;
+    if (d < 4)
+    {
+        *extra = 0;
+        *value = 0;
+        return d;
+    }
+    unsigned int b = png_bands_highest_bit(d);
+    *extra = b - 1;
+    *value = d & ((1u << (b - 1)) - 1);
+    return 2 * b + ((d >> (b - 1)) & 1);
+}
+
+/* Code lengths of at most `limit` bits for the n symbols with their frequencies (0: no code). The lengths of a Huffman
+   code (computed in place, Moffat and Katajainen) are limited by moving the deepest codes up, then handed to the
+   symbols from the rarest one on. A single symbol gets a second one, so that every code is complete. */
+static void png_bands_huffman(unsigned int* freq, unsigned int n, unsigned int limit, unsigned char* lengths)
+{
+    unsigned int symbols[288];
+    int a[288] = {0};
+    unsigned int used = 0;
+    for (unsigned int s = 0; s < n; s++)
+    {
+        lengths[s] = 0;
+        used += (freq[s] > 0);
+    }
+    for (unsigned int s = 0; (used < 2) && (s < n); s++)
+    {
+        if (freq[s] == 0)
+        {
+            freq[s] = 1;
+            used++;
+        }
+    }
+    /* sorted by frequency, then by symbol (insertion sort: at most 288 symbols) */
+    used = 0;
+    for (unsigned int s = 0; s < n; s++)
+    {
+        if (freq[s] == 0)
+        {
+            continue;
+        }
+        unsigned int k = used++;
+        while ((k > 0) && (freq[symbols[k - 1]] > freq[s]))
+        {
+            symbols[k] = symbols[k - 1];
+            k--;
+        }
+        symbols[k] = s;
+    }
+    for (unsigned int k = 0; k < used; k++)
+    {
+        a[k] = (int)freq[symbols[k]];
+    }
+
+    /* the depths of the leaves of a Huffman tree, in place */
+    int count = (int)used;
+    int root = 0, leaf = 2, next;
+    a[0] += a[1];
+    for (next = 1; next < count - 1; next++)
+    {
+        if ((leaf >= count) || (a[root] < a[leaf]))
+        {
+            a[next] = a[root];
+            a[root++] = next;
+        }
+        else
+        {
+            a[next] = a[leaf++];
+        }
+        if ((leaf >= count) || ((root < next) && (a[root] < a[leaf])))
+        {
+            a[next] += a[root];
+            a[root++] = next;
+        }
+        else
+        {
+            a[next] += a[leaf++];
+        }
+    }
+    a[count - 2] = 0;
+    for (next = count - 3; next >= 0; next--)
+    {
+        a[next] = a[a[next]] + 1;
+    }
+    int avbl = 1, depth = 0, taken = 0;
+    root = count - 2;
+    next = count - 1;
+    while (avbl > 0)
+    {
+        while ((root >= 0) && (a[root] == depth))
+        {
+            taken++;
+            root--;
+        }
+        while (avbl > taken)
+        {
+            a[next--] = depth;
+            avbl--;
+        }
+        avbl = 2 * taken;
+        depth++;
+        taken = 0;
+    }
+
+    /* the number of codes of every length, the ones deeper than the limit moved up until the code is complete again */
+    unsigned int counts[33] = {0};
+    for (int k = 0; k < count; k++)
+    {
+        counts[(a[k] < 32) ? a[k] : 32]++;
+    }
+    for (unsigned int len = limit + 1; len <= 32; len++)
+    {
+        counts[limit] += counts[len];
+        counts[len] = 0;
+    }
+    unsigned long long total = 0;
+    for (unsigned int len = 1; len <= limit; len++)
+    {
+        total += (unsigned long long)counts[len] << (limit - len);
+    }
+    while (total > (1ull << limit))
+    {
+        counts[limit]--;
+        for (unsigned int len = limit - 1; len > 0; len--)
+        {
+            if (counts[len] > 0)
+            {
+                counts[len]--;
+                counts[len + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+    /* the longest codes for the rarest symbols */
+    unsigned int k = 0;
+    for (unsigned int len = limit; len > 0; len--)
+    {
+        for (unsigned int c = 0; c < counts[len]; c++)
+        {
+            lengths[symbols[k++]] = (unsigned char)len;
+        }
+    }
+}
+
+/* the canonical codes of the lengths, bit reversed (deflate sends the codes from their highest bit on) */
+static void png_bands_codes(const unsigned char* lengths, unsigned int n, unsigned short* codes)
+{
+    unsigned int counts[16] = {0}, next[16];
+    for (unsigned int s = 0; s < n; s++)
+    {
+        counts[lengths[s]]++;
+    }
+    counts[0] = 0;
+    unsigned int code = 0;
+    for (unsigned int len = 1; len < 16; len++)
+    {
+        code = (code + counts[len - 1]) << 1;
+        next[len] = code;
+    }
+    for (unsigned int s = 0; s < n; s++)
+    {
+        unsigned int len = lengths[s], c = (len > 0) ? next[len]++ : 0, r = 0;
+        for (unsigned int b = 0; b < len; b++)
+        {
+            r = (r << 1) | ((c >> b) & 1);
+        }
+        codes[s] = (unsigned short)r;
+    }
+}
+
+/* the LZ77 state of a band: the symbols of the current block (a literal, or a length with its distance) and the hash
+   chains (positions in the band buffer, -1: none) */
+typedef struct
+{
+    const unsigned char* data;
+    size_t size;
+    int head[1 << PNG_BANDS_HASH_BITS];
+    int prev[PNG_BANDS_WINDOW];
+    unsigned short lit[PNG_BANDS_BLOCK];
+    unsigned short dist[PNG_BANDS_BLOCK];
+    unsigned int count;
+} png_bands_lz;
+
+static inline unsigned int png_bands_hash(const unsigned char* p)
+{
+    unsigned int v = (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16);
+    return (v * 2654435761u) >> (32 - PNG_BANDS_HASH_BITS);
+}
+
+static inline void png_bands_insert(png_bands_lz* lz, size_t p)
+{
+    if (p + PNG_BANDS_MATCH_MIN <= lz->size)
+    {
+        unsigned int h = png_bands_hash(lz->data + p);
+        lz->prev[p & (PNG_BANDS_WINDOW - 1)] = lz->head[h];
+        lz->head[h] = (int)p;
+    }
+}
+
+/* the longest match at p that is longer than `best` (0 if there is none) */
+static unsigned int png_bands_match(const png_bands_lz* lz, size_t p, unsigned int best, unsigned int good, unsigned int chain, unsigned int nice, unsigned int* distance)
+{
+    if (p + PNG_BANDS_MATCH_MIN > lz->size)
+    {
+        return 0;
+    }
+    const unsigned char* s = lz->data + p;
+    unsigned int max = (lz->size - p < PNG_BANDS_MATCH_MAX) ? (unsigned int)(lz->size - p) : PNG_BANDS_MATCH_MAX;
+    unsigned int found = 0;
+    int cand = lz->head[png_bands_hash(s)];
+    chain = (best >= good) ? chain >> 2 : chain;
+    best = (best < PNG_BANDS_MATCH_MIN - 1) ? PNG_BANDS_MATCH_MIN - 1 : best;
+    if (best >= max)
+    {
+        return 0;
+    }
+    while ((cand >= 0) && (p - (size_t)cand <= PNG_BANDS_WINDOW) && (chain-- > 0))
+    {
+        const unsigned char* c = lz->data + cand;
+        if ((c[best] == s[best]) && (c[0] == s[0]) && (c[1] == s[1]))
+        {
+            unsigned int len = 2;
+            while (len + 8 <= max)
+            {
+                unsigned long long x, y;
+                memcpy(&x, c + len, 8);
+                memcpy(&y, s + len, 8);
+                if (x != y)
+                {
+                    break;
+                }
+                len += 8;
+            }
+            while ((len < max) && (c[len] == s[len]))
+            {
+                len++;
+            }
+            if (len > best)
+            {
+                best = len;
+                found = len;
+                *distance = (unsigned int)(p - (size_t)cand);
+                if (len >= nice || len >= max)
+                {
+                    break;
+                }
+            }
+        }
+        int older = lz->prev[cand & (PNG_BANDS_WINDOW - 1)];
+        if (older >= cand)
+        {
+            break;
+        }
+        cand = older;
+    }
+    return found;
+}
+
+/* stored blocks of the bytes from..to */
+static int png_bands_stored(png_bands_out* out, const unsigned char* data, size_t size, int final)
+{
+    if (!png_bands_reserve(out, size + 5 * (size / 65535 + 1) + 8))
+    {
+        return 0;
+    }
+    do
+    {
+        unsigned int n = (size < 65535) ? (unsigned int)size : 65535;
+        size -= n;
+        png_bands_put(out, (final && (size == 0)) ? 1 : 0, 1);
+        png_bands_put(out, 0, 2);
+        png_bands_align(out);
+        png_bands_put(out, n | ((~n & 0xffff) << 16), 32);
+        memcpy(out->data + out->size, data, n);
+        out->size += n;
+        data += n;
+    }
+    while (size > 0);
+    return 1;
+}
+
+/* the symbols of the LZ77 state as one block with its own Huffman codes, or stored if that is smaller; the block
+   covers the `size` bytes at `data` */
+static int png_bands_block(png_bands_out* out, png_bands_lz* lz, const unsigned char* data, size_t size, int final)
+{
+    static const unsigned char order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    unsigned int lfreq[286] = {0}, dfreq[30] = {0}, cfreq[19] = {0};
+    unsigned char llen[286], dlen[30], clen[19];
+    unsigned short lcode[286], dcode[30], ccode[19];
+    unsigned int extra, value;
+    unsigned long long bits = 0;
+    for (unsigned int k = 0; k < lz->count; k++)
+    {
+        if (lz->dist[k] == 0)
+        {
+            lfreq[lz->lit[k]]++;
+        }
+        else
+        {
+            lfreq[png_bands_length_code(lz->lit[k], &extra, &value)]++;
+            bits += extra;
+            dfreq[png_bands_distance_code(lz->dist[k], &extra, &value)]++;
+            bits += extra;
+        }
+    }
+    lfreq[256] = 1;
+    png_bands_huffman(lfreq, 286, 15, llen);
+    png_bands_huffman(dfreq, 30, 15, dlen);
+    unsigned int hlit = 286, hdist = 30;
+    while ((hlit > 257) && (llen[hlit - 1] == 0))
+    {
+        hlit--;
+    }
+    while ((hdist > 1) && (dlen[hdist - 1] == 0))
+    {
+        hdist--;
+    }
+
+    /* the code lengths of both codes in one run-length coded sequence: 16 repeats the last length 3 to 6 times, 17
+       and 18 are 3 to 10 and 11 to 138 zeros */
+    unsigned char lens[286 + 30];
+    unsigned short runs[286 + 30];
+    unsigned int nlens = 0, nruns = 0;
+    for (unsigned int s = 0; s < hlit; s++)
+    {
+        lens[nlens++] = llen[s];
+    }
+    for (unsigned int s = 0; s < hdist; s++)
+    {
+        lens[nlens++] = dlen[s];
+    }
+    for (unsigned int i = 0; i < nlens;)
+    {
+        unsigned int run = 1;
+        while ((i + run < nlens) && (lens[i + run] == lens[i]))
+        {
+            run++;
+        }
+        if ((lens[i] == 0) && (run >= 3))
+        {
+            run = (run > 138) ? 138 : run;
+            runs[nruns++] = (unsigned short)(((run <= 10) ? 17 : 18) | (run << 5));
+        }
+        else if ((lens[i] != 0) && (run >= 4))
+        {
+            /* the length itself, then repeats of it */
+            runs[nruns++] = lens[i];
+            run = (run > 7) ? 7 : run;
+            runs[nruns++] = (unsigned short)(16 | ((run - 1) << 5));
+        }
+        else
+        {
+            run = 1;
+            runs[nruns++] = lens[i];
+        }
+        i += run;
+    }
+    for (unsigned int k = 0; k < nruns; k++)
+    {
+        cfreq[runs[k] & 31]++;
+    }
+    png_bands_huffman(cfreq, 19, 7, clen);
+    unsigned int hclen = 19;
+    while ((hclen > 4) && (clen[order[hclen - 1]] == 0))
+    {
+        hclen--;
+    }
+
+    /* the size of the block with these codes against the size of the stored bytes */
+    bits += 3 + 14 + 3 * hclen;
+    for (unsigned int k = 0; k < nruns; k++)
+    {
+        unsigned int sym = runs[k] & 31;
+        bits += clen[sym] + ((sym == 16) ? 2 : ((sym == 17) ? 3 : ((sym == 18) ? 7 : 0)));
+    }
+    for (unsigned int s = 0; s < 286; s++)
+    {
+        bits += (unsigned long long)lfreq[s] * llen[s];
+    }
+    for (unsigned int s = 0; s < 30; s++)
+    {
+        bits += (unsigned long long)dfreq[s] * dlen[s];
+    }
+    if ((bits + 7) / 8 >= size + 5 * (size / 65535 + 1))
+    {
+        return png_bands_stored(out, data, size, final);
+    }
+
+    if (!png_bands_reserve(out, (size_t)(bits / 8) + 16))
+    {
+        return 0;
+    }
+    png_bands_codes(llen, 286, lcode);
+    png_bands_codes(dlen, 30, dcode);
+    png_bands_codes(clen, 19, ccode);
+    png_bands_put(out, final ? 1 : 0, 1);
+    png_bands_put(out, 2, 2);
+    png_bands_put(out, hlit - 257, 5);
+    png_bands_put(out, hdist - 1, 5);
+    png_bands_put(out, hclen - 4, 4);
+    for (unsigned int k = 0; k < hclen; k++)
+    {
+        png_bands_put(out, clen[order[k]], 3);
+    }
+    for (unsigned int k = 0; k < nruns; k++)
+    {
+        unsigned int sym = runs[k] & 31, run = runs[k] >> 5;
+        png_bands_put(out, ccode[sym], clen[sym]);
+        if (sym == 16)
+        {
+            png_bands_put(out, run - 3, 2);
+        }
+        else if (sym == 17)
+        {
+            png_bands_put(out, run - 3, 3);
+        }
+        else if (sym == 18)
+        {
+            png_bands_put(out, run - 11, 7);
+        }
+    }
+    for (unsigned int k = 0; k < lz->count; k++)
+    {
+        if (lz->dist[k] == 0)
+        {
+            png_bands_put(out, lcode[lz->lit[k]], llen[lz->lit[k]]);
+        }
+        else
+        {
+            unsigned int code = png_bands_length_code(lz->lit[k], &extra, &value);
+            png_bands_put(out, lcode[code], llen[code]);
+            png_bands_put(out, value, extra);
+            code = png_bands_distance_code(lz->dist[k], &extra, &value);
+            png_bands_put(out, dcode[code], dlen[code]);
+            png_bands_put(out, value, extra);
+        }
+    }
+    png_bands_put(out, lcode[256], llen[256]);
+    return 1;
+}
+
+/* Deflates the bytes from `start` to the end of the LZ77 data (the bytes before `start` are the dictionary). The last
+   band ends with a final block, the others with an empty stored block (on a byte boundary). */
+static int png_bands_deflate(png_bands_out* out, png_bands_lz* lz, size_t start, int level, int last)
+{
+    if (level <= 0)
+    {
+        if (!png_bands_stored(out, lz->data + start, lz->size - start, last))
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        unsigned int good = png_bands_levels[level].good, lazy = png_bands_levels[level].lazy;
+        unsigned int nice = png_bands_levels[level].nice, chain = png_bands_levels[level].chain;
+        memset(lz->head, 0xff, sizeof(lz->head));
+        for (size_t p = (start > PNG_BANDS_WINDOW) ? start - PNG_BANDS_WINDOW : 0; p < start; p++)
+        {
+            png_bands_insert(lz, p);
+        }
+        lz->count = 0;
+        size_t block = start;
+        size_t p = start;
+        while (p < lz->size)
+        {
+            unsigned int distance = 0;
+            unsigned int len = png_bands_match(lz, p, 0, good, chain, nice, &distance);
+            png_bands_insert(lz, p);
+            while ((level >= 4) && (len > 0) && (len < lazy))
+            {
+                /* a longer match one byte later: p becomes a literal */
+                unsigned int later;
+                unsigned int len2 = png_bands_match(lz, p + 1, len, good, chain, nice, &later);
+                if (len2 == 0)
+                {
+                    break;
+                }
+                lz->lit[lz->count] = lz->data[p];
+                lz->dist[lz->count++] = 0;
+                p++;
+                png_bands_insert(lz, p);
+                len = len2;
+                distance = later;
+                if (lz->count >= PNG_BANDS_BLOCK - 1)
+                {
+                    break;
+                }
+            }
+            if (len > 0)
+            {
+                lz->lit[lz->count] = (unsigned short)len;
+                lz->dist[lz->count++] = (unsigned short)distance;
+                for (size_t q = p + 1; (q < p + len) && ((level >= 4) || (len <= lazy)); q++)
+                {
+                    png_bands_insert(lz, q);
+                }
+                p += len;
+            }
+            else
+            {
+                lz->lit[lz->count] = lz->data[p];
+                lz->dist[lz->count++] = 0;
+                p++;
+            }
+            if ((lz->count >= PNG_BANDS_BLOCK - 1) || (p >= lz->size))
+            {
+                if (!png_bands_block(out, lz, lz->data + block, p - block, last && (p >= lz->size)))
+                {
+                    return 0;
+                }
+                lz->count = 0;
+                block = p;
+            }
+        }
+    }
+    if (!last)
+    {
+        /* sync flush: an empty stored block */
+        if (!png_bands_reserve(out, 8))
+        {
+            return 0;
+        }
+        png_bands_put(out, 0, 3);
+        png_bands_align(out);
+        png_bands_put(out, 0xffff0000u, 32);
+    }
+    png_bands_align(out);
+    return 1;
+}
+
+/* One row filtered into dst (the filter type first). 1 bit rows get None. A bilevel 8 bit row (only 0 and 255) gets
+   Sub or Up if that has less than half the runs of equal bytes of None (the deflate matches run along the runs), any
+   other 8 bit row the one of None, Sub and Up with the smallest sum of absolute differences. */
+static void png_bands_filter(const unsigned char* row, const unsigned char* above, size_t size, unsigned int bpp, int bits, unsigned char* dst)
+{
+    unsigned long long sum_none = 0, sum_sub = 0, sum_up = 0;
+    size_t runs_none = 0, runs_sub = 0, runs_up = 0;
+    int type = 0;
+    if (!bits)
+    {
+        unsigned char last_none = 0, last_sub = 0, last_up = 0;
+        int bilevel = 1;
+        for (size_t i = 0; i < size; i++)
+        {
+            unsigned char none = row[i];
+            unsigned char sub = (unsigned char)(row[i] - ((i >= bpp) ? row[i - bpp] : 0));
+            unsigned char up = (unsigned char)(row[i] - ((above != NULL) ? above[i] : 0));
+            sum_none += (none < 128) ? none : 256 - none;
+            sum_sub += (sub < 128) ? sub : 256 - sub;
+            sum_up += (up < 128) ? up : 256 - up;
+            runs_none += (none != last_none);
+            runs_sub += (sub != last_sub);
+            runs_up += (up != last_up);
+            last_none = none;
+            last_sub = sub;
+            last_up = up;
+            bilevel &= ((none == 0) || (none == 255));
+        }
+        if (bilevel)
+        {
+            /* deflate matches a None row against the rows above anyway: Sub or Up only where it clearly wins */
+            size_t runs = (runs_up <= runs_sub) ? runs_up : runs_sub;
+            type = (2 * runs < runs_none) ? ((runs_up <= runs_sub) ? 2 : 1) : 0;
+        }
+        else
+        {
+            type = ((sum_none <= sum_sub) && (sum_none <= sum_up)) ? 0 : ((sum_up <= sum_sub) ? 2 : 1);
+        }
+    }
+    dst[0] = (unsigned char)type;
+    dst++;
+    if (type == 0)
+    {
+        memcpy(dst, row, size);
+    }
+    else if (type == 1)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            dst[i] = (unsigned char)(row[i] - ((i >= bpp) ? row[i - bpp] : 0));
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            dst[i] = (unsigned char)(row[i] - ((above != NULL) ? above[i] : 0));
+        }
+    }
+}
+
+/* the bands of the image and the compressed data of every band */
+typedef struct
+{
+    unsigned int width, height;
+    unsigned char components, depth;
+    const unsigned char* image;
+    unsigned int first;         /* the row at `image` */
+    size_t stride;
+    int level;
+    unsigned int rows;          /* rows per band */
+    unsigned int bands;
+    png_bands_out* outs;
+    unsigned int* adlers;
+    unsigned int* crcs;
+    unsigned int begin, end;    /* bands of a thread */
+    int failed;
+} png_bands_job;
+
+static void* png_bands_task(void* arg)
+{
+    png_bands_job* job = (png_bands_job*)arg;
+    int bits = (job->depth < 8);
+    size_t size = bits ? ((size_t)job->width + 7) / 8 : (size_t)job->width * job->components;
+    unsigned int bpp = bits ? 1 : job->components;
+    /* the rows of the dictionary: enough to fill the window */
+    unsigned int before = (unsigned int)((PNG_BANDS_WINDOW + size) / (size + 1));
+    png_bands_lz* lz = (png_bands_lz*)malloc(sizeof(png_bands_lz));
+    unsigned char* buffer = (unsigned char*)malloc((size + 1) * (job->rows + before));
+    if ((lz == NULL) || (buffer == NULL))
+    {
+        job->failed = 1;
+        free(lz);
+        free(buffer);
+        return NULL;
+    }
+    for (unsigned int band = job->begin; (band < job->end) && !job->failed; band++)
+    {
+        unsigned int y0 = band * job->rows;
+        unsigned int y1 = (y0 + job->rows < job->height) ? y0 + job->rows : job->height;
+        unsigned int yd = (y0 > before) ? y0 - before : 0;
+        for (unsigned int y = yd; y < y1; y++)
+        {
+            const unsigned char* row = job->image + (size_t)(y - job->first) * job->stride;
+            png_bands_filter(row, (y > 0) ? row - job->stride : NULL, size, bpp, bits, buffer + (size_t)(y - yd) * (size + 1));
+        }
+        size_t start = (size_t)(y0 - yd) * (size + 1);
+        size_t total = (size_t)(y1 - yd) * (size + 1);
+        lz->data = buffer;
+        lz->size = total;
+        png_bands_out* out = &job->outs[band];
+        if (band == 0)
+        {
+            /* the zlib header: deflate with a window of 32 KB, no dictionary */
+            if (!png_bands_reserve(out, 2))
+            {
+                job->failed = 1;
+                break;
+            }
+            out->data[out->size++] = 0x78;
+            out->data[out->size++] = (job->level <= 1) ? 0x01 : ((job->level < 6) ? 0x5e : ((job->level == 6) ? 0x9c : 0xda));
+        }
+        if (!png_bands_deflate(out, lz, start, job->level, band == job->bands - 1))
+        {
+            job->failed = 1;
+            break;
+        }
+        job->adlers[band] = png_bands_adler32(1, buffer + start, total - start);
+        job->crcs[band] = png_bands_crc32(png_bands_crc32(0, (const unsigned char*)"IDAT", 4), out->data, out->size);
+    }
+    free(lz);
+    free(buffer);
+    return NULL;
+}
+
+/* a chunk: its length, type, data and the CRC of the type and the data (computed if `crc` is NULL) */
+static int png_bands_chunk(png_bands_write_func write_func, void* user, const char* type, const unsigned char* data, size_t size, const unsigned int* crc)
+{
+    unsigned char head[8] = {(unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8), (unsigned char)size,
+        (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3]};
+    unsigned int sum = (crc != NULL) ? *crc : png_bands_crc32(png_bands_crc32(0, head + 4, 4), data, size);
+    unsigned char tail[4] = {(unsigned char)(sum >> 24), (unsigned char)(sum >> 16), (unsigned char)(sum >> 8), (unsigned char)sum};
+    return write_func(user, head, 8) && ((size == 0) || write_func(user, data, size)) && write_func(user, tail, 4);
+}
+
+/* the signature and the header: 8 or 1 bit, deflate, filter method 0, no interlace */
+static int png_bands_header(png_bands_write_func write_func, void* user, unsigned int width, unsigned int height, unsigned char components, unsigned char depth)
+{
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    static const unsigned char color_types[5] = {0, 0, 4, 2, 6};
+    unsigned char header[13] = {(unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+        depth, color_types[components], 0, 0, 0};
+    return write_func(user, signature, 8) && png_bands_chunk(write_func, user, "IHDR", header, 13, NULL);
+}
+
+/* sets up the bands of an image (the rows of `image` from row 0 on), returns 0 if there is no memory */
+static int png_bands_job_init(png_bands_job* job, unsigned int width, unsigned int height, unsigned char components, unsigned char depth, const unsigned char* image, size_t stride, int level)
+{
+    size_t size = (depth < 8) ? ((size_t)width + 7) / 8 : (size_t)width * components;
+    memset(job, 0, sizeof(*job));
+    job->width = width;
+    job->height = height;
+    job->components = components;
+    job->depth = depth;
+    job->image = image;
+    job->stride = stride;
+    job->level = (level < 0) ? 0 : ((level > 9) ? 9 : level);
+    job->rows = (PNG_BANDS_SIZE / (size + 1) > 0) ? (unsigned int)(PNG_BANDS_SIZE / (size + 1)) : 1;
+    job->bands = (height + job->rows - 1) / job->rows;
+    job->outs = (png_bands_out*)calloc(job->bands, sizeof(png_bands_out));
+    job->adlers = (unsigned int*)malloc(job->bands * sizeof(unsigned int));
+    job->crcs = (unsigned int*)malloc(job->bands * sizeof(unsigned int));
+    return (job->outs != NULL) && (job->adlers != NULL) && (job->crcs != NULL);
+}
+
+static void png_bands_job_free(png_bands_job* job)
+{
+    for (unsigned int band = 0; (job->outs != NULL) && (band < job->bands); band++)
+    {
+        free(job->outs[band].data);
+    }
+    free(job->outs);
+    free(job->adlers);
+    free(job->crcs);
+}
+
+/* deflates the bands from `begin` to `end` in contiguous shares, the first one on the calling thread */
+static int png_bands_run(const png_bands_job* job, unsigned int begin, unsigned int end, int threads)
+{
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+    if (threads > PNG_BANDS_THREADS_MAX)
+    {
+        threads = PNG_BANDS_THREADS_MAX;
+    }
+    if ((unsigned int)threads > end - begin)
+    {
+        threads = (int)(end - begin);
+    }
+    png_bands_job jobs[threads];
+    for (int k = 0; k < threads; k++)
+    {
+        jobs[k] = *job;
+        jobs[k].begin = begin + (unsigned int)((unsigned long long)(end - begin) * k / threads);
+        jobs[k].end = begin + (unsigned int)((unsigned long long)(end - begin) * (k + 1) / threads);
+    }
+#ifndef PNG_BANDS_NO_THREADS
+    pthread_t ids[threads];
+    int started[threads];
+    for (int k = 1; k < threads; k++)
+    {
+        started[k] = (pthread_create(&ids[k], NULL, png_bands_task, &jobs[k]) == 0);
+    }
+    png_bands_task(&jobs[0]);
+    for (int k = 1; k < threads; k++)
+    {
+        if (started[k])
+        {
+            pthread_join(ids[k], NULL);
+        }
+        else
+        {
+            png_bands_task(&jobs[k]);
+        }
+    }
+#else
+    for (int k = 0; k < threads; k++)
+    {
+        png_bands_task(&jobs[k]);
+    }
+#endif
+    int ok = 1;
+    for (int k = 0; k < threads; k++)
+    {
+        ok = ok && !jobs[k].failed;
+    }
+    return ok;
+}
+
+/* writes the deflated bands from `begin` to `end` as IDAT chunks and frees them, `adler` goes on over their data */
+static int png_bands_idat(png_bands_write_func write_func, void* user, png_bands_job* job, unsigned int begin, unsigned int end, unsigned int* adler)
+{
+    size_t size = (job->depth < 8) ? ((size_t)job->width + 7) / 8 : (size_t)job->width * job->components;
+    int ok = 1;
+    for (unsigned int band = begin; (band < end) && ok; band++)
+    {
+        unsigned int y0 = band * job->rows;
+        unsigned int rows = (y0 + job->rows < job->height) ? job->rows : job->height - y0;
+        *adler = png_bands_adler32_combine(*adler, job->adlers[band], (size + 1) * rows);
+        png_bands_out* out = &job->outs[band];
+        if (band < job->bands - 1)
+        {
+            ok = png_bands_chunk(write_func, user, "IDAT", out->data, out->size, &job->crcs[band]);
+        }
+        else
+        {
+            /* the last band carries the Adler-32 of the whole stream, its CRC goes on over it */
+            unsigned char trailer[4] = {(unsigned char)(*adler >> 24), (unsigned char)(*adler >> 16), (unsigned char)(*adler >> 8), (unsigned char)*adler};
+            unsigned int crc = png_bands_crc32(job->crcs[band], trailer, 4);
+            ok = png_bands_reserve(out, 4);
+            if (ok)
+            {
+                memcpy(out->data + out->size, trailer, 4);
+                out->size += 4;
+                ok = png_bands_chunk(write_func, user, "IDAT", out->data, out->size, &crc);
+            }
+        }
+        free(out->data);
+        out->data = NULL;
+        out->size = out->capacity = 0;
+    }
+    return ok;
+}
+
+static int png_bands_valid(unsigned int width, unsigned int height, unsigned char components, unsigned char depth)
+{
+    return (width > 0) && (height > 0) && (components >= 1) && (components <= 4) && ((depth == 8) || ((depth == 1) && (components == 1)));
+}
+
+int png_bands_write(png_bands_write_func write_func, void* user, unsigned int width, unsigned int height, unsigned char components, unsigned char depth, const unsigned char* image, size_t stride, int level, int threads)
+{
+    if (!png_bands_valid(width, height, components, depth))
+    {
+        return 0;
+    }
+    png_bands_job job;
+    unsigned int adler = 1;
+    int ok = png_bands_job_init(&job, width, height, components, depth, image, stride, level)
+        && png_bands_run(&job, 0, job.bands, threads)
+        && png_bands_header(write_func, user, width, height, components, depth)
+        && png_bands_idat(write_func, user, &job, 0, job.bands, &adler)
+        && png_bands_chunk(write_func, user, "IEND", NULL, 0, NULL);
+    png_bands_job_free(&job);
+    return ok;
+}
+
+struct png_bands_stream
+{
+    png_bands_write_func write_func;
+    void* user;
+    int threads;
+    png_bands_job job;          /* `image` is `buffer`, `first` the row at its start */
+    unsigned char* buffer;      /* the rows above the next band (its dictionary and the row above it), then its rows */
+    unsigned int keep;          /* rows kept above the next band */
+    unsigned int count;         /* rows in the buffer */
+    unsigned int band;          /* the next band to deflate */
+    unsigned int adler;
+    int failed;
+};
+
+png_bands_stream* png_bands_begin(png_bands_write_func write_func, void* user, unsigned int width, unsigned int height, unsigned char components, unsigned char depth, int level, int threads)
+{
+    if (!png_bands_valid(width, height, components, depth))
+    {
+        return NULL;
+    }
+    png_bands_stream* stream = (png_bands_stream*)calloc(1, sizeof(png_bands_stream));
+    if (stream == NULL)
+    {
+        return NULL;
+    }
+    size_t size = (depth < 8) ? ((size_t)width + 7) / 8 : (size_t)width * components;
+    int ok = png_bands_job_init(&stream->job, width, height, components, depth, NULL, size, level);
+    stream->write_func = write_func;
+    stream->user = user;
+    stream->threads = (threads < 1) ? 1 : ((threads > PNG_BANDS_THREADS_MAX) ? PNG_BANDS_THREADS_MAX : threads);
+    if ((unsigned int)stream->threads > stream->job.bands)
+    {
+        stream->threads = (int)stream->job.bands;
+    }
+    stream->keep = (unsigned int)((PNG_BANDS_WINDOW + size) / (size + 1)) + 1;
+    stream->adler = 1;
+    if (ok)
+    {
+        stream->buffer = (unsigned char*)malloc(size * (stream->keep + (size_t)stream->threads * stream->job.rows));
+        stream->job.image = stream->buffer;
+        ok = (stream->buffer != NULL) && png_bands_header(write_func, user, width, height, components, depth);
+    }
+    if (!ok)
+    {
+        png_bands_job_free(&stream->job);
+        free(stream->buffer);
+        free(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+int png_bands_rows(png_bands_stream* stream, const unsigned char* rows, size_t stride, unsigned int count)
+{
+    png_bands_job* job = &stream->job;
+    size_t size = job->stride;
+    while ((count > 0) && !stream->failed)
+    {
+        unsigned int y = job->first + stream->count;
+        if (y >= job->height)
+        {
+            stream->failed = 1;
+            break;
+        }
+        memcpy(stream->buffer + (size_t)stream->count * size, rows, size);
+        rows += stride;
+        count--;
+        stream->count++;
+        y++;
+        /* a group of `threads` bands (or the last bands) is complete: deflate it, write it and keep the rows above the next one */
+        unsigned int end = (stream->band + stream->threads < job->bands) ? stream->band + stream->threads : job->bands;
+        if ((y == end * job->rows) || (y == job->height))
+        {
+            stream->failed = !png_bands_run(job, stream->band, end, stream->threads)
+                || !png_bands_idat(stream->write_func, stream->user, job, stream->band, end, &stream->adler);
+            stream->band = end;
+            unsigned int keep = (stream->count < stream->keep) ? stream->count : stream->keep;
+            memmove(stream->buffer, stream->buffer + (size_t)(stream->count - keep) * size, (size_t)keep * size);
+            job->first = y - keep;
+            stream->count = keep;
+        }
+    }
+    return !stream->failed;
+}
+
+int png_bands_end(png_bands_stream* stream)
+{
+    int ok = !stream->failed && (stream->band == stream->job.bands)
+        && png_bands_chunk(stream->write_func, stream->user, "IEND", NULL, 0, NULL);
+    png_bands_job_free(&stream->job);
+    free(stream->buffer);
+    free(stream);
+    return ok;
+}
+
+#endif  /* PNG_BANDS_IMPLEMENTATION */
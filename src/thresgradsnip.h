@@ -1,6 +1,6 @@
 /**
 
-Grad (aka "Gradient Snip") threshold v1.2
+Grad (aka "Gradient Snip") threshold v1.15
 By zvezdochiot <mykaralw@yandex.ru>
 This is free and unencumbered software released into the public domain.
 
@@ -28,8 +28,138 @@ QUICK START
         stbi_write_png("foo.thresgrad.png", width, height, components, image, 0);
     }
 
+image_threshold_gradsnip(), image_threshold_gradsnip_value() and image_threshold_gradsnip_apply() threshold with a byte
+blur of the caller on the calling thread. The blur itself, threads and the float, fixed point, luma and pyramid blurs
+go through a context (see CONTEXT below).
+
+The value step of a context runs inside its blur, the apply step over bands of rows, on up to `threads` threads: the
+calling thread and the workers of the blur context (see CONTEXT in iir_gauss_blur.h, 1 or less: the calling thread
+only, define IIR_GAUSS_BLUR_NO_THREADS to build without pthreads, THRESHOLD_GRADSNIP_NO_THREADS to keep the apply step
+on the calling thread). The black samples are counted per band, so the BW metric does not depend on the number of
+threads.
+
+FUSED BLUR
+
+    #define IIR_GAUSS_BLUR_IMPLEMENTATION
+    #include "iir_gauss_blur.h"
+
+The value step of a context blurs the image into a float buffer of the context (`width * height * components` floats),
+the statistics are gathered piece by piece of a row inside the last pass of the blur and the apply step reads the float
+blur directly. The float blur is truncated to 8 bit on the fly, exactly like the byte blur of iir_gauss_blur(),
+so the result is the same as with image_threshold_gradsnip(). The blur runs on up to `threads`
+threads, the sums of each column block are kept apart and added in block order, so the result
+does not depend on the number of threads.
+
+STRIPS
+
+image_threshold_gradsnip_value_row() adds the sums of one row (with a float blur) to `sums`
+(2 * components doubles, zero them first), image_threshold_gradsnip_value_sums() turns the sums of
+all rows into the thresholds and the gradient. image_threshold_gradsnip_apply_row() thresholds one
+row and returns the number of black samples. With iir_gauss_blur_strips() an image can be processed
+in two runs over its strips, the first adding up the sums, the second thresholding the rows.
+
+BITS
+
+The apply step of a context with `bits` not NULL and image_threshold_gradsnip_apply_row_bits() leave the image as it is
+and pack the result into `bits`, 1 bit per sample (most significant bit first, 1 = white, 0 = black, as in a 1 bit gray
+PNG) with `bits_stride` bytes (at least (width * components + 7) / 8) from one row to the next. The samples are the
+same as those of the 8 bit result, the byte result is never written.
+
+FIXED POINT BLUR
+
+A context initialized with `fixed` not 0 keeps the blur in 16 bit fixed point (see FIXED POINT in iir_gauss_blur.h),
+`width * height * components` unsigned shorts, half the memory of the float blur. The fixed point blur differs from
+the float blur by at most iir_gauss_blur_fixed_deviation(sigma), so a sample right at its threshold may come out
+differently.
+
+OUT OF PLACE
+
+The apply step of a context only reads `image` and writes the 8 bit result into `result` (or the image itself), so the
+image can be read-only (a mapped file) and the result can go straight into its place in the output (a mapped PGM/PPM
+file).
+
+LUMA
+
+A context initialized with `luma` not 0 thresholds the luma (Y = (77 R + 150 G + 29 B) >> 8, as stb_image converts to
+gray) of an image with `components` components (the first one of a gray image) and gives a single component result:
+its blur and `result` are `width * height`. The luma is computed from the samples as they are read, in the blur and in
+both steps, so no gray copy of the image is made. The result is the same as thresholding the image converted to gray.
+
+PYRAMID
+
+A context initialized with `pyramid` not 0 runs the value step with the pyramid blur (see PYRAMID in iir_gauss_blur.h):
+the image is blurred at 1 / factor of its size and the statistics are gathered while the blur is upsampled into the
+blur of the context. The apply step is the usual one on that blur.
+
+CONTEXT
+
+image_threshold_gradsnip_context_init() sets up a context for a service that thresholds image after image with the same
+settings: the coefficients of the blur are computed once for sigma, the blur (float, or fixed point if `fixed` is not 0,
+the pyramid blur if `pyramid` is not 0, of the luma if `luma` is not 0), the scratch of the blur and the sums per column
+block are buffers of the context that only grow. Once they fit the largest image, image_threshold_gradsnip_context_run()
+allocates nothing and starts no threads: the workers are started once by image_threshold_gradsnip_context_init() (none
+with `threads` 1) and stopped by image_threshold_gradsnip_context_free(). The image does not have
+to be packed: its rows are `stride` bytes apart (0: `width * step`) and its pixels `step` bytes (0: `components`); the
+`components` thresholded channels start at `image`, so other channels are skipped by offsetting `image` and `step`.
+The result (`components` channels per pixel, 1 with `luma`) goes to `result` with rows `result_stride` bytes apart
+(0: packed), which may be the image itself if `step` is `components`, or packed into `bits` unless it is NULL.
+Returns the BW metric, or -1 if a buffer can't grow; the gradient and the thresholds are left in the context.
+image_threshold_gradsnip_context_value() and image_threshold_gradsnip_context_apply() are the two steps: the apply
+step can run again on the same image after `coef`, `delta` or the bounds of the context are changed.
+
+    image_threshold_gradsnip_context ctx;
+    image_threshold_gradsnip_context_init(&ctx, sigma, 1, coef, delta, bound_lower, bound_upper, 0, 0, 0);
+    // for every frame: threshold R, G and B of an RGBA frame into a packed RGB result
+    float bwm = image_threshold_gradsnip_context_run(&ctx, width, height, 3, frame, stride, 4, result, 0, NULL, 0);
+    ...
+    image_threshold_gradsnip_context_free(&ctx);
+
+REGION
+
+After image_threshold_gradsnip_context_value() the context keeps the blur and the thresholds of the page (its size and
+components too), so an interactive preview only runs the apply step on what is shown when `coef`, `delta` or the bounds
+change. image_threshold_gradsnip_context_apply_region() thresholds the region of `width` x `height` pixels at `x`, `y` of
+the page (`image` is the origin of the page, as given to the value step) into a result of its own: with `factor` 1 the
+region as it is, with a larger `factor` every factor-th pixel of every factor-th row, a (width + factor - 1) / factor by
+(height + factor - 1) / factor preview that reads 1 / factor^2 of the page; its samples are the same as those of the full
+result at these pixels (no blur or threshold at a lower resolution, so a preview of a page at factor 4 takes about 1/16 of
+the apply step), but strokes thinner than `factor` pixels may drop out of it. Returns the BW metric of the region, or -1
+if the region is not inside the page or the context has no blur.
+
+image_threshold_gradsnip_context_apply_tiles() keeps a result of the whole page up to date tile by tile: the page is cut
+into tiles of `size` pixels (image_threshold_gradsnip_tiles_init(), rounded up to a multiple of 8, 0: 256), and only the
+tiles that the view at `x`, `y` (clipped to the page) touches and that are not thresholded with the current settings of
+the context yet run through the apply step, on the threads of the context. A new page (another value step) or other
+settings make every tile stale, scrolling back over tiles that are up to date costs nothing. `result` (or `bits`) is the
+result of the whole page (0 strides: packed) and must be the same from call to call (image_threshold_gradsnip_tiles_reset()
+after it is changed elsewhere). Returns the number of tiles thresholded, or -1 if the context has no blur or the list of
+tiles can't grow.
+
+    image_threshold_gradsnip_tiles tiles;
+    image_threshold_gradsnip_tiles_init(&tiles, 256);
+    image_threshold_gradsnip_context_value(&ctx, width, height, 1, page, 0, 0);
+    // a slider moved: a quick preview of the page at 1/4, then the view at full size
+    ctx.coef = coef;
+    float bwm = image_threshold_gradsnip_context_apply_region(&ctx, page, 0, 0, 0, 0, width, height, 4, preview, 0, NULL, 0);
+    int count = image_threshold_gradsnip_context_apply_tiles(&ctx, &tiles, page, 0, 0, view_x, view_y, view_width, view_height, result, 0, NULL, 0);
+    ...
+    image_threshold_gradsnip_tiles_free(&tiles);
+
 VERSION HISTORY
 
+1.15  2026-10-17  "pool"    Apply step on the workers of the blur context, no threads started per image.
+1.14  2026-10-17  "api"    The byte blur functions without threads again, the other variants only through the context.
+1.13  2026-10-17  "region"    Apply step of a region, a preview or the stale tiles of a view with the blur of the context.
+1.12  2026-10-17  "kernels"    Value and apply in one pass over the pixels, specialized for 1 to 4 components.
+1.11  2026-10-17  "context"    Reusable context with row stride and pixel step, no allocations per image.
+1.10  2026-10-16  "pyramid"    Value step with the pyramid blur.
+1.9  2026-10-16  "luma"    Threshold of the luma of a color image without a gray copy.
+1.8  2026-10-16  "to"    Apply step into another buffer (read-only image).
+1.7  2026-10-16  "cutoffs"    Apply step with a table of integer cut-offs per channel, without branches.
+1.6  2026-10-16  "fixed"    16 bit fixed point blur.
+1.5  2026-10-16  "bits"    Result packed to 1 bit per sample.
+1.4  2026-10-16  "bands"    Value and apply over bands of rows on several threads.
+1.3  2026-10-16  "fused"    Float blur and statistics inside the last pass of the blur.
 1.2  2024-12-25  "head"    Header release.
 1.1  2024-12-17  "regulator"    Add regulator: delta and bounds: lower and upper.
 1.0  2024-12-16  "init"    Initial release.
@@ -38,13 +168,62 @@ VERSION HISTORY
 
 #ifndef THRESHOLD_GRADSNIP_H
 #define THRESHOLD_GRADSNIP_H
+#include <stddef.h>
+#include "iir_gauss_blur.h"
 #ifdef __cplusplus
     extern "C" {
 #endif
 
+/* settings, blur coefficients and buffers kept from image to image (see CONTEXT above) */
+typedef struct
+{
+    float coef, delta;
+    unsigned char bound_lower, bound_upper;
+    int fixed;
+    int luma;
+    iir_gauss_blur_context blur;
+    void* buffer;
+    size_t buffer_size;
+    double* blocks;
+    size_t blocks_size;
+    float gradient;
+    unsigned char threshold_global[256];
+    unsigned int width, height;
+    unsigned char components;
+    unsigned int page;
+} image_threshold_gradsnip_context;
+
+/* the tiles of the result of a page that are thresholded with the settings of the context (see REGION above) */
+typedef struct
+{
+    unsigned int size;
+    unsigned int columns, rows;
+    unsigned int page;
+    float coef, delta;
+    unsigned char bound_lower, bound_upper;
+    unsigned char* fresh;
+    size_t fresh_size;
+    unsigned int* list;
+    size_t list_size;
+} image_threshold_gradsnip_tiles;
+
 float image_threshold_gradsnip_value(unsigned int width, unsigned int height, unsigned char components, unsigned char* image, unsigned char* blur, unsigned char* threshold_global);
 float image_threshold_gradsnip_apply(unsigned int width, unsigned int height, unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, unsigned char* image, unsigned char* blur, unsigned char* threshold_global);
 void image_threshold_gradsnip(unsigned int width, unsigned int height, unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int info, unsigned char* image, unsigned char* blur, unsigned char* threshold_global);
+void image_threshold_gradsnip_value_row(unsigned int width, unsigned char components, const unsigned char* image, const float* blur, double* sums);
+size_t image_threshold_gradsnip_apply_row(unsigned int width, unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, unsigned char* image, const float* blur, const unsigned char* threshold_global);
+float image_threshold_gradsnip_value_sums(unsigned int width, unsigned int height, unsigned char components, const double* sums, unsigned char* threshold_global);
+size_t image_threshold_gradsnip_apply_row_bits(unsigned int width, unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, const unsigned char* image, const float* blur, const unsigned char* threshold_global, unsigned char* bits);
+void image_threshold_gradsnip_context_init(image_threshold_gradsnip_context* ctx, float sigma, int threads, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int fixed, int pyramid, int luma);
+void image_threshold_gradsnip_context_free(image_threshold_gradsnip_context* ctx);
+float image_threshold_gradsnip_context_value(image_threshold_gradsnip_context* ctx, unsigned int width, unsigned int height, unsigned char components, const unsigned char* image, size_t stride, unsigned char step);
+float image_threshold_gradsnip_context_apply(image_threshold_gradsnip_context* ctx, unsigned int width, unsigned int height, unsigned char components, const unsigned char* image, size_t stride, unsigned char step, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride);
+float image_threshold_gradsnip_context_run(image_threshold_gradsnip_context* ctx, unsigned int width, unsigned int height, unsigned char components, const unsigned char* image, size_t stride, unsigned char step, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride);
+float image_threshold_gradsnip_context_apply_region(image_threshold_gradsnip_context* ctx, const unsigned char* image, size_t stride, unsigned char step, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int factor, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride);
+void image_threshold_gradsnip_tiles_init(image_threshold_gradsnip_tiles* tiles, unsigned int size);
+void image_threshold_gradsnip_tiles_reset(image_threshold_gradsnip_tiles* tiles);
+void image_threshold_gradsnip_tiles_free(image_threshold_gradsnip_tiles* tiles);
+int image_threshold_gradsnip_context_apply_tiles(image_threshold_gradsnip_context* ctx, image_threshold_gradsnip_tiles* tiles, const unsigned char* image, size_t stride, unsigned char step, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride);
 
 #ifdef __cplusplus
     }
@@ -55,36 +234,353 @@ void image_threshold_gradsnip(unsigned int width, unsigned int height, unsigned
 #include <stdlib.h>
 #include <math.h>
 
-float image_threshold_gradsnip_value(unsigned int width, unsigned int height, unsigned char components, unsigned char* image, unsigned char* blur, unsigned char* threshold_global)
+#ifndef THRESHOLD_GRADSNIP_THREADS_MAX
+#define THRESHOLD_GRADSNIP_THREADS_MAX 256
+#endif
+/* kernels specialized by inlining them with constant arguments (the number of components, the kind of the blur) */
+#if defined(__GNUC__)
+#define THRESHOLD_GRADSNIP_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define THRESHOLD_GRADSNIP_INLINE static __forceinline
+#else
+#define THRESHOLD_GRADSNIP_INLINE static inline
+#endif
+
+static inline unsigned char image_threshold_gradsnip_byte(float b)
 {
-    float gradient = 0.0f;
-    if ((image != NULL) && (blur != NULL) && (threshold_global != NULL))
+    /* the same truncation as the byte image written by iir_gauss_blur() */
+    return (b > 0.0f) ? ((b < 255.0f) ? (unsigned char)b : 255) : 0;
+}
+
+/* one band of rows (begin to end - 1) of the apply step, blur is a byte, a float or a fixed point blur,
+   the apply step thresholds with the cut-offs into result (the image itself or another buffer) or packs the result
+   into bits (stride bytes per row) if bits is not NULL; the pixels of the image are step bytes apart and its rows
+   image_stride bytes, the rows of the result result_stride bytes and the rows of the blur blur_stride samples; the apply
+   step reads every factor-th pixel of a row (the rows are already factor rows apart), or thresholds the tiles begin to
+   end - 1 of tiles (x, y, width and height of every tile) if it is not NULL; with luma > 0 the luma of the first luma
+   channels of every pixel is thresholded (components is 1) */
+typedef struct
+{
+    unsigned int width, height;
+    unsigned char components;
+    unsigned char luma;
+    unsigned char step;
+    unsigned char* image;
+    size_t image_stride;
+    unsigned char* result;
+    size_t result_stride;
+    const unsigned char* blur;
+    const float* blur_float;
+    const unsigned short* blur_fixed;
+    const unsigned short* cutoffs;
+    unsigned char* bits;
+    size_t stride;
+    size_t blur_stride;
+    unsigned int factor;
+    const unsigned int* tiles;
+    size_t count_black;
+    unsigned int begin, end;
+} image_threshold_gradsnip_band;
+
+static inline unsigned char image_threshold_gradsnip_byte_fixed(unsigned short q)
+{
+    /* the same as image_threshold_gradsnip_byte(IIR_GAUSS_BLUR_FROM_FIXED(q)) */
+    unsigned int v = q / IIR_GAUSS_BLUR_FIXED_SCALE;
+    return (v > IIR_GAUSS_BLUR_FIXED_OFFSET) ? ((v - IIR_GAUSS_BLUR_FIXED_OFFSET < 255) ? (unsigned char)(v - IIR_GAUSS_BLUR_FIXED_OFFSET) : 255) : 0;
+}
+
+/* the blur byte at sample i of a byte (kind 0), float (kind 1) or fixed point (kind 2) blur */
+THRESHOLD_GRADSNIP_INLINE unsigned int image_threshold_gradsnip_blur_kind(int kind, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed, size_t i)
+{
+    return (kind == 0) ? blur[i] : ((kind == 1) ? image_threshold_gradsnip_byte(blur_float[i]) : image_threshold_gradsnip_byte_fixed(blur_fixed[i]));
+}
+
+/* The sums of the value step over the pixels of a line: the sample s and the blur b are bytes, so g and g * s are
+   integers and the sums are exact in any order; all channels (up to 4 at a time) are summed in one pass, in integers. */
+THRESHOLD_GRADSNIP_INLINE void image_threshold_gradsnip_value_pixels(unsigned int width, unsigned char components, unsigned char step, unsigned char luma, int kind, const unsigned char* image, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed, double* sums)
+{
+    for (unsigned char c0 = 0; c0 < components; c0 += 4)
+    {
+        unsigned char n = ((components - c0) < 4) ? (components - c0) : 4;
+        unsigned long long sum_gl[4] = {0, 0, 0, 0}, sum_gil[4] = {0, 0, 0, 0};
+        size_t i = c0, j = c0;
+        for (unsigned int x = 0; x < width; x++)
+        {
+            for (unsigned char c = 0; c < n; c++)
+            {
+                unsigned int s = luma ? iir_gauss_blur_luma(image + j, luma) : image[j + c];
+                unsigned int b = image_threshold_gradsnip_blur_kind(kind, blur, blur_float, blur_fixed, i + c);
+                unsigned int g = (s < b) ? (b - s) : (s - b);
+                sum_gl[c] += g;
+                sum_gil[c] += g * s;
+            }
+            i += components;
+            j += step;
+        }
+        for (unsigned char c = 0; c < n; c++)
+        {
+            sums[2 * (c0 + c)] += (double)sum_gl[c];
+            sums[2 * (c0 + c) + 1] += (double)sum_gil[c];
+        }
+    }
+}
+
+/* calls CALL(components, luma, kind) with constants for 1 to 4 components and the kind of the blur, so that the loops
+   of the kernel unroll over the components (luma: one component with the luma channels as they are) */
+#define IMAGE_THRESHOLD_GRADSNIP_DISPATCH(CALL) \
+    int kind = (blur != NULL) ? 0 : ((blur_float != NULL) ? 1 : 2); \
+    if (luma) \
+    { \
+        CALL(1, luma, kind); \
+    } \
+    else \
+    { \
+        switch (components * 3 + kind) \
+        { \
+            case 3: CALL(1, 0, 0); break; \
+            case 4: CALL(1, 0, 1); break; \
+            case 5: CALL(1, 0, 2); break; \
+            case 6: CALL(2, 0, 0); break; \
+            case 7: CALL(2, 0, 1); break; \
+            case 8: CALL(2, 0, 2); break; \
+            case 9: CALL(3, 0, 0); break; \
+            case 10: CALL(3, 0, 1); break; \
+            case 11: CALL(3, 0, 2); break; \
+            case 12: CALL(4, 0, 0); break; \
+            case 13: CALL(4, 0, 1); break; \
+            case 14: CALL(4, 0, 2); break; \
+            default: CALL(components, 0, kind); break; \
+        } \
+    }
+
+static void image_threshold_gradsnip_value_line(unsigned int width, unsigned char components, unsigned char step, unsigned char luma, const unsigned char* image, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed, double* sums)
+{
+#define IMAGE_THRESHOLD_GRADSNIP_VALUE(N, L, K) image_threshold_gradsnip_value_pixels(width, N, step, L, K, image, blur, blur_float, blur_fixed, sums)
+    IMAGE_THRESHOLD_GRADSNIP_DISPATCH(IMAGE_THRESHOLD_GRADSNIP_VALUE)
+#undef IMAGE_THRESHOLD_GRADSNIP_VALUE
+}
+
+/* A sample s is black if s < bound_lower or (s <= bound_upper and s < t) with t = b * coef + tg * (1 - coef) + delta.
+   For an integer s, s < t is the same as s < ceil(t), so the black samples are the ones below one cut-off that only
+   depends on the blur byte b and the channel: 256 cut-offs (0 to 256) per channel, computed with exactly the float
+   formula above, turn the apply step into a table lookup and an integer compare. */
+static void image_threshold_gradsnip_cutoffs(unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, const unsigned char* threshold_global, unsigned short* cutoffs)
+{
+    for (unsigned char c = 0; c < components; c++)
+    {
+        float tg = threshold_global[c];
+        for (unsigned int v = 0; v < 256; v++)
+        {
+            float b = v;
+            float t = b * coef + tg * (1.0f - coef) + delta;
+            int cut = (t > 0.0f) ? ((t < 256.0f) ? (int)ceilf(t) : 256) : 0;
+            cut = (cut < bound_upper + 1) ? cut : bound_upper + 1;
+            cut = (cut > bound_lower) ? cut : bound_lower;
+            cutoffs[c * 256 + v] = (unsigned short)cut;
+        }
+    }
+}
+
+/* the apply step over width pixels of a line (every factor-th pixel of the image and the blur) into result (bits NULL)
+   or packed into bits, without branches: black is 1 below the cut-off, the sample becomes black - 1 (0 or 255) */
+THRESHOLD_GRADSNIP_INLINE size_t image_threshold_gradsnip_apply_pixels(unsigned int width, unsigned char components, unsigned char step, unsigned char luma, int kind, unsigned int factor, const unsigned short* cutoffs, const unsigned char* image, unsigned char* result, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed, unsigned char* bits)
+{
+    size_t count_black = 0;
+    /* i is the sample of the blur, j the byte of the image, r the sample of the result */
+    size_t i = 0, j = 0, r = 0;
+    unsigned int acc = 0, n = 0;
+    for (unsigned int x = 0; x < width; x++)
     {
         for (unsigned char c = 0; c < components; c++)
         {
-            size_t i = c;
-            double sum_gi = 0.0, sum_g = 0.0;
-            for (unsigned int y = 0; y < height; y++)
+            unsigned int s = luma ? iir_gauss_blur_luma(image + j, luma) : image[j + c];
+            unsigned int black = s < cutoffs[c * 256 + image_threshold_gradsnip_blur_kind(kind, blur, blur_float, blur_fixed, i + c)];
+            count_black += black;
+            if (bits == NULL)
+            {
+                result[r + c] = (unsigned char)(black - 1);
+            }
+            else
             {
-                double sum_gil = 0.0, sum_gl = 0.0;
-                for (unsigned int x = 0; x < width; x++)
+                acc = (acc << 1) | (black ^ 1);
+                if (++n == 8)
                 {
-                    float s = image[i];
-                    float b = blur[i];
-                    float g = (s < b) ? (b - s) : (s - b);
-                    sum_gl += g;
-                    sum_gil += (g * s);
-                    i += components;
+                    *bits++ = (unsigned char)acc;
+                    acc = 0;
+                    n = 0;
                 }
-                sum_g += sum_gl;
-                sum_gi += sum_gil;
             }
-            float threshold = (sum_g > 0) ? (sum_gi / sum_g) : 127.5f;
-            threshold_global[c] = (threshold < 0.0f) ? 0 : ((threshold < 255.0f) ? (unsigned char)(threshold + 0.5f) : 255);
-            gradient += (sum_g / width / height);
         }
+        i += (size_t)components * factor;
+        j += (size_t)step * factor;
+        r += components;
+    }
+    if ((bits != NULL) && (n > 0))
+    {
+        /* the padding of the last byte is black */
+        *bits = (unsigned char)(acc << (8 - n));
+    }
+    return count_black;
+}
+
+static size_t image_threshold_gradsnip_apply_line(unsigned int width, unsigned char components, unsigned char step, unsigned char luma, const unsigned short* cutoffs, const unsigned char* image, unsigned char* result, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed)
+{
+    size_t count_black = 0;
+#define IMAGE_THRESHOLD_GRADSNIP_APPLY(N, L, K) count_black = image_threshold_gradsnip_apply_pixels(width, N, step, L, K, 1, cutoffs, image, result, blur, blur_float, blur_fixed, NULL)
+    IMAGE_THRESHOLD_GRADSNIP_DISPATCH(IMAGE_THRESHOLD_GRADSNIP_APPLY)
+#undef IMAGE_THRESHOLD_GRADSNIP_APPLY
+    return count_black;
+}
+
+static size_t image_threshold_gradsnip_apply_line_bits(unsigned int width, unsigned char components, unsigned char step, unsigned char luma, const unsigned short* cutoffs, const unsigned char* image, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed, unsigned char* bits)
+{
+    size_t count_black = 0;
+#define IMAGE_THRESHOLD_GRADSNIP_APPLY(N, L, K) count_black = image_threshold_gradsnip_apply_pixels(width, N, step, L, K, 1, cutoffs, image, NULL, blur, blur_float, blur_fixed, bits)
+    IMAGE_THRESHOLD_GRADSNIP_DISPATCH(IMAGE_THRESHOLD_GRADSNIP_APPLY)
+#undef IMAGE_THRESHOLD_GRADSNIP_APPLY
+    return count_black;
+}
+
+#undef IMAGE_THRESHOLD_GRADSNIP_DISPATCH
+
+/* a preview reads every factor-th pixel: not specialized, the loads of the blur and the image dominate */
+static size_t image_threshold_gradsnip_apply_line_sampled(unsigned int width, unsigned char components, unsigned char step, unsigned char luma, unsigned int factor, const unsigned short* cutoffs, const unsigned char* image, unsigned char* result, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed, unsigned char* bits)
+{
+    int kind = (blur != NULL) ? 0 : ((blur_float != NULL) ? 1 : 2);
+    return image_threshold_gradsnip_apply_pixels(width, components, step, luma, kind, factor, cutoffs, image, result, blur, blur_float, blur_fixed, bits);
+}
+
+static void* image_threshold_gradsnip_apply_band(void* arg)
+{
+    image_threshold_gradsnip_band* band = (image_threshold_gradsnip_band*)arg;
+    size_t line = band->blur_stride;
+    size_t count_black = 0;
+    for (unsigned int y = band->begin; y < band->end; y++)
+    {
+        const unsigned char* blur = (band->blur != NULL) ? band->blur + y * line : NULL;
+        const float* blur_float = (band->blur_float != NULL) ? band->blur_float + y * line : NULL;
+        const unsigned short* blur_fixed = (band->blur_fixed != NULL) ? band->blur_fixed + y * line : NULL;
+        if (band->factor > 1)
+        {
+            count_black += image_threshold_gradsnip_apply_line_sampled(band->width, band->components, band->step, band->luma, band->factor, band->cutoffs, band->image + y * band->image_stride,
+                (band->bits != NULL) ? NULL : band->result + y * band->result_stride, blur, blur_float, blur_fixed, (band->bits != NULL) ? band->bits + y * band->stride : NULL);
+        }
+        else if (band->bits != NULL)
+        {
+            count_black += image_threshold_gradsnip_apply_line_bits(band->width, band->components, band->step, band->luma, band->cutoffs, band->image + y * band->image_stride, blur, blur_float, blur_fixed, band->bits + y * band->stride);
+        }
+        else
+        {
+            count_black += image_threshold_gradsnip_apply_line(band->width, band->components, band->step, band->luma, band->cutoffs, band->image + y * band->image_stride, band->result + y * band->result_stride, blur, blur_float, blur_fixed);
+        }
+    }
+    band->count_black = count_black;
+    return NULL;
+}
+
+/* the tiles begin to end - 1 of the list: image, result, bits and blur are at the origin of the page, every tile is
+   a band of its own that starts on a byte of bits (the x of a tile is a multiple of 8) */
+static void* image_threshold_gradsnip_apply_tiles_band(void* arg)
+{
+    image_threshold_gradsnip_band* band = (image_threshold_gradsnip_band*)arg;
+    size_t count_black = 0;
+    for (unsigned int k = band->begin; k < band->end; k++)
+    {
+        const unsigned int* tile = band->tiles + (size_t)4 * k;
+        size_t x = (size_t)tile[0] * band->components;
+        size_t offset = (size_t)tile[1] * band->blur_stride + x;
+        image_threshold_gradsnip_band view = *band;
+        view.width = tile[2];
+        view.height = tile[3];
+        view.image = band->image + tile[1] * band->image_stride + (size_t)tile[0] * band->step;
+        view.result = (band->result != NULL) ? band->result + tile[1] * band->result_stride + x : NULL;
+        view.blur = (band->blur != NULL) ? band->blur + offset : NULL;
+        view.blur_float = (band->blur_float != NULL) ? band->blur_float + offset : NULL;
+        view.blur_fixed = (band->blur_fixed != NULL) ? band->blur_fixed + offset : NULL;
+        view.bits = (band->bits != NULL) ? band->bits + tile[1] * band->stride + x / 8 : NULL;
+        view.begin = 0;
+        view.end = tile[3];
+        image_threshold_gradsnip_apply_band(&view);
+        count_black += view.count_black;
+    }
+    band->count_black = count_black;
+    return NULL;
+}
+
+/* split the rows into up to `threads` of the blur context bands (1 without a context), run func on them on the workers of
+   the context (the first band on the calling thread) and return the sum of count_black */
+static size_t image_threshold_gradsnip_run(iir_gauss_blur_context* context, void* (*func)(void*), image_threshold_gradsnip_band* proto)
+{
+    int threads = (context != NULL) ? context->threads : 1;
+#ifdef THRESHOLD_GRADSNIP_NO_THREADS
+    threads = 1;
+#endif
+    if (threads > THRESHOLD_GRADSNIP_THREADS_MAX)
+    {
+        threads = THRESHOLD_GRADSNIP_THREADS_MAX;
+    }
+    if ((unsigned int)threads > proto->height)
+    {
+        threads = proto->height;
+    }
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    image_threshold_gradsnip_band bands[threads];
+    for (int k = 0; k < threads; k++)
+    {
+        bands[k] = *proto;
+        bands[k].begin = (unsigned int)((unsigned long long)proto->height * k / threads);
+        bands[k].end = (unsigned int)((unsigned long long)proto->height * (k + 1) / threads);
+        bands[k].count_black = 0;
+    }
+    iir_gauss_blur_context_dispatch(context, func, bands, sizeof(bands[0]), (unsigned int)threads);
+
+    size_t count_black = 0;
+    for (int k = 0; k < threads; k++)
+    {
+        count_black += bands[k].count_black;
+    }
+    return count_black;
+}
+
+/* the value step of a byte, float or fixed point blur on the calling thread */
+static float image_threshold_gradsnip_value_lines(unsigned int width, unsigned int height, unsigned char components, unsigned char* image, size_t image_stride, const unsigned char* blur, unsigned char* threshold_global)
+{
+    size_t nsums = (size_t)2 * components;
+    double sums[nsums];
+    for (size_t k = 0; k < nsums; k++)
+    {
+        sums[k] = 0.0;
+    }
+    size_t line = (size_t)width * components;
+    for (unsigned int y = 0; y < height; y++)
+    {
+        image_threshold_gradsnip_value_line(width, components, components, 0, image + y * image_stride, blur + y * line, NULL, NULL, sums);
+    }
+
+    return image_threshold_gradsnip_value_sums(width, height, components, sums, threshold_global);
+}
+
+static float image_threshold_gradsnip_apply_bands(iir_gauss_blur_context* context, unsigned int width, unsigned int height, unsigned char components, unsigned char luma, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, unsigned char* image, size_t image_stride, unsigned char step, unsigned char* result, size_t result_stride, const unsigned char* blur, const float* blur_float, const unsigned short* blur_fixed, unsigned char* threshold_global, unsigned char* bits, size_t stride)
+{
+    unsigned short cutoffs[256 * components];
+    image_threshold_gradsnip_cutoffs(components, coef, delta, bound_lower, bound_upper, threshold_global, cutoffs);
+    image_threshold_gradsnip_band proto = {width, height, components, luma, step, image, image_stride, result, result_stride, blur, blur_float, blur_fixed, cutoffs, bits, stride, (size_t)width * components, 1, NULL, 0, 0, height};
+    size_t count_black = image_threshold_gradsnip_run(context, image_threshold_gradsnip_apply_band, &proto);
+
+    return (double) count_black / ((double)width * height * components);
+}
+
+float image_threshold_gradsnip_value(unsigned int width, unsigned int height, unsigned char components, unsigned char* image, unsigned char* blur, unsigned char* threshold_global)
+{
+    float gradient = 0.0f;
+    if ((image != NULL) && (blur != NULL) && (threshold_global != NULL))
+    {
+        gradient = image_threshold_gradsnip_value_lines(width, height, components, image, (size_t)width * components, blur, threshold_global);
     }
-    gradient /= components;
 
     return gradient;
 }
@@ -94,32 +590,22 @@ float image_threshold_gradsnip_apply(unsigned int width, unsigned int height, un
     float bwm = 0.0f;
     if ((image != NULL) && (blur != NULL) && (threshold_global != NULL))
     {
-        size_t count_black = 0;
+        bwm = image_threshold_gradsnip_apply_bands(NULL, width, height, components, 0, coef, delta, bound_lower, bound_upper, image, (size_t)width * components, components, image, (size_t)width * components, blur, NULL, NULL, threshold_global, NULL, 0);
+    }
+    return bwm;
+}
+
+static void image_threshold_gradsnip_info(unsigned char components, float gradient, float bwm, unsigned char* threshold_global)
+{
+    fprintf(stderr, "INFO: gradient %f\n", gradient);
+    if (threshold_global != NULL)
+    {
         for (unsigned char c = 0; c < components; c++)
         {
-            size_t i = c;
-            float tg = threshold_global[c];
-            for (unsigned int y = 0; y < height; y++)
-            {
-                for (unsigned int x = 0; x < width; x++)
-                {
-                    float s = image[i];
-                    float b = blur[i];
-                    float t = b * coef + tg * (1.0f - coef) + delta;
-                    unsigned char retval = 255;
-                    if ((s < bound_lower) || ((s <= bound_upper) && (s < t)))
-                    {
-                        retval = 0;
-                        count_black++;
-                    }
-                    image[i] = retval;
-                    i += components;
-                }
-            }
+            fprintf(stderr, "INFO: component %d : threshold %d\n", c, threshold_global[c]);
         }
-        bwm = (double) count_black / (width * height * components);
     }
-    return bwm;
+    fprintf(stderr, "INFO: BW metric %f\n", bwm);
 }
 
 void image_threshold_gradsnip(unsigned int width, unsigned int height, unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int info, unsigned char* image, unsigned char* blur, unsigned char* threshold_global)
@@ -135,16 +621,344 @@ void image_threshold_gradsnip(unsigned int width, unsigned int height, unsigned
     float bwm = image_threshold_gradsnip_apply(width, height, components, coef, delta, bound_lower, bound_upper, image, blur, threshold_global);
     if (info > 0)
     {
-        fprintf(stderr, "INFO: gradient %f\n", gradient);
-        if ((image != NULL) && (blur != NULL) && (threshold_global != NULL))
+        image_threshold_gradsnip_info(components, gradient, bwm, ((image != NULL) && (blur != NULL)) ? threshold_global : NULL);
+    }
+}
+
+void image_threshold_gradsnip_value_row(unsigned int width, unsigned char components, const unsigned char* image, const float* blur, double* sums)
+{
+    image_threshold_gradsnip_value_line(width, components, components, 0, image, NULL, blur, NULL, sums);
+}
+
+size_t image_threshold_gradsnip_apply_row(unsigned int width, unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, unsigned char* image, const float* blur, const unsigned char* threshold_global)
+{
+    unsigned short cutoffs[256 * components];
+    image_threshold_gradsnip_cutoffs(components, coef, delta, bound_lower, bound_upper, threshold_global, cutoffs);
+    return image_threshold_gradsnip_apply_line(width, components, components, 0, cutoffs, image, image, NULL, blur, NULL);
+}
+
+float image_threshold_gradsnip_value_sums(unsigned int width, unsigned int height, unsigned char components, const double* sums, unsigned char* threshold_global)
+{
+    float gradient = 0.0f;
+    for (unsigned char c = 0; c < components; c++)
+    {
+        double sum_g = sums[c + c], sum_gi = sums[c + c + 1];
+        float threshold = (sum_g > 0) ? (sum_gi / sum_g) : 127.5f;
+        threshold_global[c] = (threshold < 0.0f) ? 0 : ((threshold < 255.0f) ? (unsigned char)(threshold + 0.5f) : 255);
+        gradient += (sum_g / width / height);
+    }
+    gradient /= components;
+
+    return gradient;
+}
+
+typedef struct
+{
+    unsigned int width;
+    unsigned char components;
+    unsigned char luma;
+    unsigned char step;
+    const unsigned char* image;
+    size_t stride;
+    double* blocks;
+} image_threshold_gradsnip_blur_rows;
+
+static void image_threshold_gradsnip_blur_row(void* user, unsigned int y, unsigned int x0, unsigned int x1, const float* row)
+{
+    image_threshold_gradsnip_blur_rows* r = (image_threshold_gradsnip_blur_rows*)user;
+    size_t offset = (size_t)x0 * r->components;
+    double* sums = r->blocks + (size_t)(x0 / IIR_GAUSS_BLUR_BLOCK) * 2 * r->components;
+    const unsigned char* image = r->image + (size_t)y * r->stride + (size_t)x0 * r->step;
+    image_threshold_gradsnip_value_line(x1 - x0, r->components, r->step, r->luma, image, NULL, row + offset, NULL, sums);
+}
+
+/* the value step inside the last pass of the blur of the context (float, fixed point if blur_fixed is not NULL, or pyramid),
+   the sums are kept per column block in blocks (2 * components doubles per block of IIR_GAUSS_BLUR_BLOCK columns); -1 if
+   the scratch of the blur can't grow; with luma > 0 the luma of the first luma channels of every pixel is blurred
+   (components is 1) */
+static float image_threshold_gradsnip_value_fused(iir_gauss_blur_context* context, unsigned int width, unsigned int height, unsigned char components, unsigned char luma, unsigned char* image, size_t image_stride, unsigned char step, float* blur, unsigned short* blur_fixed, double* blocks, unsigned char* threshold_global)
+{
+    /* the last pass of the blur runs over column blocks: keep the sums per block and add them in block order */
+    size_t nsums = (size_t)2 * components;
+    size_t nblocks = ((size_t)width + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK;
+    if (blur_fixed != NULL)
+    {
+        blur = NULL;
+    }
+    for (size_t k = 0; k < nsums * nblocks; k++)
+    {
+        blocks[k] = 0.0;
+    }
+    image_threshold_gradsnip_blur_rows r = {width, components, luma, step, image, image_stride, blocks};
+    if (!iir_gauss_blur_context_run(context, width, height, components, luma, image, image_stride, step, blur, blur_fixed, image_threshold_gradsnip_blur_row, &r))
+    {
+        return -1.0f;
+    }
+
+    double sums[nsums];
+    for (size_t k = 0; k < nsums; k++)
+    {
+        sums[k] = 0.0;
+    }
+    for (size_t j = 0; j < nblocks; j++)
+    {
+        for (size_t k = 0; k < nsums; k++)
         {
-            for (unsigned char c = 0; c < components; c++)
+            sums[k] += blocks[j * nsums + k];
+        }
+    }
+
+    return image_threshold_gradsnip_value_sums(width, height, components, sums, threshold_global);
+}
+
+size_t image_threshold_gradsnip_apply_row_bits(unsigned int width, unsigned char components, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, const unsigned char* image, const float* blur, const unsigned char* threshold_global, unsigned char* bits)
+{
+    unsigned short cutoffs[256 * components];
+    image_threshold_gradsnip_cutoffs(components, coef, delta, bound_lower, bound_upper, threshold_global, cutoffs);
+    return image_threshold_gradsnip_apply_line_bits(width, components, components, 0, cutoffs, image, NULL, blur, NULL, bits);
+}
+
+/* a buffer of the context with at least size bytes: it only grows (the old one is freed, not copied) */
+static void* image_threshold_gradsnip_context_grow(void** buffer, size_t* capacity, size_t size)
+{
+    if (size > *capacity)
+    {
+        free(*buffer);
+        *buffer = malloc(size);
+        *capacity = (*buffer != NULL) ? size : 0;
+    }
+    return *buffer;
+}
+
+void image_threshold_gradsnip_context_init(image_threshold_gradsnip_context* ctx, float sigma, int threads, float coef, float delta, unsigned char bound_lower, unsigned char bound_upper, int fixed, int pyramid, int luma)
+{
+    ctx->coef = coef;
+    ctx->delta = delta;
+    ctx->bound_lower = (bound_lower < bound_upper) ? bound_lower : bound_upper;
+    ctx->bound_upper = (bound_lower < bound_upper) ? bound_upper : bound_lower;
+    ctx->fixed = fixed;
+    ctx->luma = luma;
+    iir_gauss_blur_context_init(&ctx->blur, sigma, threads, pyramid);
+    ctx->buffer = NULL;
+    ctx->buffer_size = 0;
+    ctx->blocks = NULL;
+    ctx->blocks_size = 0;
+    ctx->gradient = 0.0f;
+    for (int c = 0; c < 256; c++)
+    {
+        ctx->threshold_global[c] = 0;
+    }
+    ctx->width = 0;
+    ctx->height = 0;
+    ctx->components = 0;
+    ctx->page = 0;
+}
+
+void image_threshold_gradsnip_context_free(image_threshold_gradsnip_context* ctx)
+{
+    iir_gauss_blur_context_free(&ctx->blur);
+    free(ctx->buffer);
+    free(ctx->blocks);
+    ctx->buffer = NULL;
+    ctx->buffer_size = 0;
+    ctx->blocks = NULL;
+    ctx->blocks_size = 0;
+    ctx->page = 0;
+}
+
+float image_threshold_gradsnip_context_value(image_threshold_gradsnip_context* ctx, unsigned int width, unsigned int height, unsigned char components, const unsigned char* image, size_t stride, unsigned char step)
+{
+    if ((image == NULL) || (components < 1))
+    {
+        return -1.0f;
+    }
+    step = (step > 0) ? step : components;
+    stride = (stride > 0) ? stride : (size_t)width * step;
+    /* the luma of a single channel is the channel itself */
+    unsigned char result_components = ctx->luma ? 1 : components;
+    unsigned char luma = (ctx->luma && (components > 1)) ? components : 0;
+    size_t size = (size_t)width * height * result_components * (ctx->fixed ? sizeof(unsigned short) : sizeof(float));
+    size_t nblocks = ((size_t)width + IIR_GAUSS_BLUR_BLOCK - 1) / IIR_GAUSS_BLUR_BLOCK;
+    void* buffer = image_threshold_gradsnip_context_grow(&ctx->buffer, &ctx->buffer_size, size);
+    void* blocks = image_threshold_gradsnip_context_grow((void**)&ctx->blocks, &ctx->blocks_size, (size_t)2 * result_components * nblocks * sizeof(double));
+    if ((buffer == NULL) || (blocks == NULL))
+    {
+        return -1.0f;
+    }
+
+    ctx->gradient = image_threshold_gradsnip_value_fused(&ctx->blur, width, height, result_components, luma, (unsigned char*)image, stride, step,
+        ctx->fixed ? NULL : (float*)buffer, ctx->fixed ? (unsigned short*)buffer : NULL, (double*)blocks, ctx->threshold_global);
+    /* the blur in the buffer is the one of this page now: a new page for the tiles */
+    ctx->width = width;
+    ctx->height = height;
+    ctx->components = components;
+    ctx->page = (ctx->gradient < 0.0f) ? 0 : ctx->page + 1;
+    return ctx->gradient;
+}
+
+float image_threshold_gradsnip_context_apply(image_threshold_gradsnip_context* ctx, unsigned int width, unsigned int height, unsigned char components, const unsigned char* image, size_t stride, unsigned char step, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride)
+{
+    if ((image == NULL) || (components < 1) || (ctx->buffer == NULL) || ((result == NULL) && (bits == NULL)))
+    {
+        return 0.0f;
+    }
+    step = (step > 0) ? step : components;
+    stride = (stride > 0) ? stride : (size_t)width * step;
+    unsigned char result_components = ctx->luma ? 1 : components;
+    unsigned char luma = (ctx->luma && (components > 1)) ? components : 0;
+    result_stride = (result_stride > 0) ? result_stride : (size_t)width * result_components;
+
+    return image_threshold_gradsnip_apply_bands(&ctx->blur, width, height, result_components, luma, ctx->coef, ctx->delta, ctx->bound_lower, ctx->bound_upper,
+        (unsigned char*)image, stride, step, result, result_stride, NULL, ctx->fixed ? NULL : (float*)ctx->buffer, ctx->fixed ? (unsigned short*)ctx->buffer : NULL,
+        ctx->threshold_global, bits, bits_stride);
+}
+
+float image_threshold_gradsnip_context_run(image_threshold_gradsnip_context* ctx, unsigned int width, unsigned int height, unsigned char components, const unsigned char* image, size_t stride, unsigned char step, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride)
+{
+    if (image_threshold_gradsnip_context_value(ctx, width, height, components, image, stride, step) < 0.0f)
+    {
+        return -1.0f;
+    }
+    return image_threshold_gradsnip_context_apply(ctx, width, height, components, image, stride, step, result, result_stride, bits, bits_stride);
+}
+
+float image_threshold_gradsnip_context_apply_region(image_threshold_gradsnip_context* ctx, const unsigned char* image, size_t stride, unsigned char step, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned int factor, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride)
+{
+    if ((image == NULL) || (ctx->page == 0) || (factor < 1) || (width < 1) || (height < 1) || (x > ctx->width) || (width > ctx->width - x)
+        || (y > ctx->height) || (height > ctx->height - y) || ((result == NULL) && (bits == NULL)))
+    {
+        return -1.0f;
+    }
+    unsigned char components = ctx->components;
+    step = (step > 0) ? step : components;
+    stride = (stride > 0) ? stride : (size_t)ctx->width * step;
+    unsigned char result_components = ctx->luma ? 1 : components;
+    unsigned char luma = (ctx->luma && (components > 1)) ? components : 0;
+    /* the result has a pixel for every factor-th pixel of every factor-th row of the region */
+    unsigned int columns = (width - 1) / factor + 1, rows = (height - 1) / factor + 1;
+    result_stride = (result_stride > 0) ? result_stride : (size_t)columns * result_components;
+    bits_stride = (bits_stride > 0) ? bits_stride : ((size_t)columns * result_components + 7) / 8;
+    size_t line = (size_t)ctx->width * result_components;
+    size_t offset = (size_t)y * line + (size_t)x * result_components;
+
+    unsigned short cutoffs[256 * result_components];
+    image_threshold_gradsnip_cutoffs(result_components, ctx->coef, ctx->delta, ctx->bound_lower, ctx->bound_upper, ctx->threshold_global, cutoffs);
+    image_threshold_gradsnip_band proto = {columns, rows, result_components, luma, step, (unsigned char*)image + y * stride + (size_t)x * step, stride * factor,
+        result, result_stride, NULL, ctx->fixed ? NULL : (const float*)ctx->buffer + offset, ctx->fixed ? (const unsigned short*)ctx->buffer + offset : NULL,
+        cutoffs, bits, bits_stride, line * factor, factor, NULL, 0, 0, rows};
+    size_t count_black = image_threshold_gradsnip_run(&ctx->blur, image_threshold_gradsnip_apply_band, &proto);
+
+    return (double) count_black / ((double)columns * rows * result_components);
+}
+
+void image_threshold_gradsnip_tiles_init(image_threshold_gradsnip_tiles* tiles, unsigned int size)
+{
+    /* a tile starts on a byte of packed rows */
+    size = (size + 7) / 8 * 8;
+    tiles->size = (size > 0) ? size : 256;
+    tiles->columns = 0;
+    tiles->rows = 0;
+    tiles->fresh = NULL;
+    tiles->fresh_size = 0;
+    tiles->list = NULL;
+    tiles->list_size = 0;
+    image_threshold_gradsnip_tiles_reset(tiles);
+}
+
+void image_threshold_gradsnip_tiles_reset(image_threshold_gradsnip_tiles* tiles)
+{
+    /* the page of a context that has a blur is never 0 */
+    tiles->page = 0;
+}
+
+void image_threshold_gradsnip_tiles_free(image_threshold_gradsnip_tiles* tiles)
+{
+    free(tiles->fresh);
+    free(tiles->list);
+    tiles->fresh = NULL;
+    tiles->fresh_size = 0;
+    tiles->list = NULL;
+    tiles->list_size = 0;
+    tiles->page = 0;
+}
+
+int image_threshold_gradsnip_context_apply_tiles(image_threshold_gradsnip_context* ctx, image_threshold_gradsnip_tiles* tiles, const unsigned char* image, size_t stride, unsigned char step, unsigned int x, unsigned int y, unsigned int width, unsigned int height, unsigned char* result, size_t result_stride, unsigned char* bits, size_t bits_stride)
+{
+    if ((image == NULL) || (ctx->page == 0) || ((result == NULL) && (bits == NULL)))
+    {
+        return -1;
+    }
+    unsigned char components = ctx->components;
+    step = (step > 0) ? step : components;
+    stride = (stride > 0) ? stride : (size_t)ctx->width * step;
+    unsigned char result_components = ctx->luma ? 1 : components;
+    unsigned char luma = (ctx->luma && (components > 1)) ? components : 0;
+    result_stride = (result_stride > 0) ? result_stride : (size_t)ctx->width * result_components;
+    bits_stride = (bits_stride > 0) ? bits_stride : ((size_t)ctx->width * result_components + 7) / 8;
+    unsigned int size = tiles->size;
+    unsigned int columns = (ctx->width + size - 1) / size, rows = (ctx->height + size - 1) / size;
+    size_t count = (size_t)columns * rows;
+
+    /* another page or other settings: every tile is stale */
+    if ((tiles->page != ctx->page) || (tiles->columns != columns) || (tiles->rows != rows) || (tiles->coef != ctx->coef) || (tiles->delta != ctx->delta)
+        || (tiles->bound_lower != ctx->bound_lower) || (tiles->bound_upper != ctx->bound_upper))
+    {
+        tiles->page = 0;
+        if (image_threshold_gradsnip_context_grow((void**)&tiles->fresh, &tiles->fresh_size, count) == NULL)
+        {
+            return -1;
+        }
+        for (size_t k = 0; k < count; k++)
+        {
+            tiles->fresh[k] = 0;
+        }
+        tiles->page = ctx->page;
+        tiles->columns = columns;
+        tiles->rows = rows;
+        tiles->coef = ctx->coef;
+        tiles->delta = ctx->delta;
+        tiles->bound_lower = ctx->bound_lower;
+        tiles->bound_upper = ctx->bound_upper;
+    }
+    if (image_threshold_gradsnip_context_grow((void**)&tiles->list, &tiles->list_size, count * 4 * sizeof(unsigned int)) == NULL)
+    {
+        return -1;
+    }
+
+    /* the stale tiles that the view (clipped to the page) touches */
+    unsigned int n = 0;
+    if ((x < ctx->width) && (y < ctx->height) && (width > 0) && (height > 0))
+    {
+        width = (width < ctx->width - x) ? width : ctx->width - x;
+        height = (height < ctx->height - y) ? height : ctx->height - y;
+        for (unsigned int ty = y / size; ty <= (y + height - 1) / size; ty++)
+        {
+            for (unsigned int tx = x / size; tx <= (x + width - 1) / size; tx++)
             {
-                fprintf(stderr, "INFO: component %d : threshold %d\n", c, threshold_global[c]);
+                size_t k = (size_t)ty * columns + tx;
+                if (!tiles->fresh[k])
+                {
+                    unsigned int* tile = tiles->list + (size_t)4 * n++;
+                    tile[0] = tx * size;
+                    tile[1] = ty * size;
+                    tile[2] = (size < ctx->width - tile[0]) ? size : ctx->width - tile[0];
+                    tile[3] = (size < ctx->height - tile[1]) ? size : ctx->height - tile[1];
+                    tiles->fresh[k] = 1;
+                }
             }
         }
-        fprintf(stderr, "INFO: BW metric %f\n", bwm);
     }
+    if (n > 0)
+    {
+        unsigned short cutoffs[256 * result_components];
+        image_threshold_gradsnip_cutoffs(result_components, ctx->coef, ctx->delta, ctx->bound_lower, ctx->bound_upper, ctx->threshold_global, cutoffs);
+        image_threshold_gradsnip_band proto = {ctx->width, n, result_components, luma, step, (unsigned char*)image, stride, result, result_stride,
+            NULL, ctx->fixed ? NULL : (const float*)ctx->buffer, ctx->fixed ? (const unsigned short*)ctx->buffer : NULL,
+            cutoffs, bits, bits_stride, (size_t)ctx->width * result_components, 1, tiles->list, 0, 0, n};
+        image_threshold_gradsnip_run(&ctx->blur, image_threshold_gradsnip_apply_tiles_band, &proto);
+    }
+
+    return (int)n;
 }
 
 #endif  /* THRESHOLD_GRADSNIP_IMPLEMENTATION */